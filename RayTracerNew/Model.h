@@ -5,36 +5,149 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+#include <cfloat>
 #include "aabb.h"
+#include "bvh.h"
+#include "mesh_cache.h"
 
-struct Vertex
+#include <chrono>
+#include <climits>
+#include <memory>
+#include <unordered_map>
+
+struct TexCoord
 {
-	vec3 Position;
-	vec3 TexCoord;
+	float u;
+	float v;
 };
 
+// Everything the intersection loop reads for a triangle, precomputed once and
+// stored as one array per component in BVH leaf order.
+struct TriangleSoA
+{
+	void Build(const vec3* positions, const uint32_t* indices, size_t triangleCount);
+	// Use twelve arrays of `triangleCount` floats that live elsewhere.
+	void Attach(const float* data, size_t triangleCount);
+	size_t MemoryBytes() const { return 12 * count * sizeof(float); }
+
+	std::vector<float> storage;
+	const float* data = nullptr;
+	size_t count = 0;
+	const float *v0x, *v0y, *v0z;
+	const float *e1x, *e1y, *e1z;
+	const float *e2x, *e2y, *e2z;
+	const float *nx, *ny, *nz;
+};
+
+void TriangleSoA::Build(const vec3* positions, const uint32_t* indices, size_t triangleCount)
+{
+	storage.resize(12 * triangleCount);
+	float* out[12];
+	for (int k = 0; k < 12; ++k)
+		out[k] = storage.data() + k * triangleCount;
+
+	for (size_t i = 0; i < triangleCount; ++i)
+	{
+		const vec3& p0 = positions[indices[3 * i]];
+		vec3 e1 = positions[indices[3 * i + 1]] - p0;
+		vec3 e2 = positions[indices[3 * i + 2]] - p0;
+		vec3 n = unit_vector(cross(e1, e2));
+		for (int a = 0; a < 3; ++a)
+		{
+			out[a][i] = p0[a];
+			out[3 + a][i] = e1[a];
+			out[6 + a][i] = e2[a];
+			out[9 + a][i] = n[a];
+		}
+	}
+	Attach(storage.data(), triangleCount);
+}
+
+void TriangleSoA::Attach(const float* base, size_t triangleCount)
+{
+	data = base;
+	count = triangleCount;
+	const float** arrays[12] = { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z, &nx, &ny, &nz };
+	for (int k = 0; k < 12; ++k)
+		*arrays[k] = base + k * triangleCount;
+}
+
 class Model : public hittable
 {
 public:
 	Model() = default;
-	Model(std::string _modelPath, std::string file, material* mat);
+	Model(std::string _modelPath, std::string file, material* mat, bool precomputeTriangles = true);
 	virtual bool hit(const ray& ray, float t_min, float t_max, hit_record& record)const;
+	virtual int hit4(const ray4& rays, int active, float t_min, float* t_max, hit_record* records) const;
 	virtual bool bounding_box(float t0, float t1, aabb& box) const;
 
-	//virtual bool bounding_box(float t0, float t1, aabb& box) const;
-	bool rayTriangleIntersect(const ray& ray, float t_min, float t_max, hit_record& record, const Vertex& v0, const Vertex& v1, const Vertex& v2)const;
+	// Moller-Trumbore against triangle `tri`; only t and the barycentrics
+	// are produced, the record is filled once for the closest hit.
+	bool rayTriangleIntersect(const ray& ray, int tri, float t_min, float t_max, float& t, float& u, float& v) const;
+	// The same test for the four lanes of a packet; returns the lanes that hit.
+	int rayTriangleIntersect4(const ray4& rays, int tri, float4 t_min, float4 t_max, float4& t, float4& u, float4& v) const;
+	void FillRecord(const ray& ray, int tri, float t, float u, float v, hit_record& record) const;
+
+	void LoadObj(const std::string& _modelPath, const std::string& file);
+	void BuildBVH(const std::string& name);
+	bool LoadCache(const std::string& cachePath, const mesh_cache_key& key);
+	bool WriteCache(const std::string& cachePath, const mesh_cache_key& key) const;
+	uint32_t CacheLayout() const;
+	int TriangleCount() const { return int(m_triangleCount); }
+	size_t MemoryBytes() const;
+	// binary and wide triangle BVH nodes, mapped or owned
+	size_t BvhBytes() const { return m_bvh.memory_bytes() + m_bvh.wide_bytes(); }
+
+	// What the hit path reads. These point into the vectors below after an
+	// OBJ load, or straight into the mapped cache file on a warm start.
+	const vec3* m_positions = nullptr;
+	const TexCoord* m_texcoords = nullptr;
+	const uint32_t* m_indices = nullptr;
+	uint32_t m_vertexCount = 0;
+	uint32_t m_triangleCount = 0;
+	TriangleSoA m_triangles;
+	bool m_precomputed;
+
+	std::vector<vec3> m_positionData;
+	std::vector<TexCoord> m_texcoordData;
+	std::vector<uint32_t> m_indexData;
+	std::unique_ptr<mapped_file> m_cacheFile;
 
-	std::vector<Vertex> m_model;
 	material* m_material;
-	
+	bvh_tree m_bvh;
+	aabb m_bounds;
 };
 
-Model::Model(std::string _modelPath, std::string file, material* mat)
+Model::Model(std::string _modelPath, std::string file, material* mat, bool precomputeTriangles)
 {
+	auto start = std::chrono::high_resolution_clock::now();
 
 	m_material = mat;
+	m_precomputed = precomputeTriangles;
 
-	
+	// a binary cache next to the obj, valid while the obj keeps its size and
+	// mtime, skips parsing and the BVH build entirely
+	std::string filepath = _modelPath + file;
+	std::string cachePath = filepath + ".rtmesh";
+	mesh_cache_key key;
+	bool haveKey = mesh_cache_key_for(filepath, key);
+	bool warm = haveKey && LoadCache(cachePath, key);
+
+	if (!warm)
+	{
+		LoadObj(_modelPath, file);
+		BuildBVH(file);
+		if (haveKey && !WriteCache(cachePath, key))
+			std::cout << "Could not write mesh cache " << cachePath << "\n";
+	}
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << " - mesh " << file << (warm ? " warm start (mapped cache) " : " cold start (obj parse + bvh) ")
+		<< ms << " ms\n";
+}
+
+void Model::LoadObj(const std::string& _modelPath, const std::string& file)
+{
 	//std::string inputfile = "cornell_box.obj";
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
@@ -55,77 +168,296 @@ Model::Model(std::string _modelPath, std::string file, material* mat)
 		exit(1);
 	}
 
+	// obj indexes positions and texcoords separately; every distinct pair
+	// becomes one shared vertex
+	std::unordered_map<uint64_t, uint32_t> remap;
 	for (const auto& shape : shapes)
 	{
 		for (const auto& index : shape.mesh.indices)
 		{
-			Vertex vertex;
+			uint64_t key = (uint64_t(uint32_t(index.vertex_index)) << 32) | uint32_t(index.texcoord_index + 1);
+			auto found = remap.find(key);
+			if (found != remap.end())
+			{
+				m_indexData.push_back(found->second);
+				continue;
+			}
 
-			vertex.Position = vec3(
+			uint32_t vertex = uint32_t(m_positionData.size());
+			m_positionData.push_back(vec3(
 				attrib.vertices[3 * index.vertex_index + 0],
 				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]);
+				attrib.vertices[3 * index.vertex_index + 2]));
 
+			TexCoord uv = { 0.0f, 0.0f };
 			if (index.texcoord_index >= 0)
 			{
-				vertex.TexCoord = vec3(
-					attrib.texcoords[2 * index.texcoord_index + 0],
-					attrib.texcoords[2 * index.texcoord_index + 1], 0.0f);
-			}
-			else
-			{
-				vertex.TexCoord = vec3(0, 0, 0);
+				uv.u = attrib.texcoords[2 * index.texcoord_index + 0];
+				uv.v = attrib.texcoords[2 * index.texcoord_index + 1];
 			}
-			
-			m_model.push_back(vertex);
-			
+			m_texcoordData.push_back(uv);
+
+			remap.emplace(key, vertex);
+			m_indexData.push_back(vertex);
 		}
 	}
 
-	if (m_model.size() % 3 != 0)
+	if (m_indexData.size() % 3 != 0)
 	{
 		std::cout << "One of the triangles is not a triangle" << std::endl;
 		exit(1);
 	}
 
+	m_positions = m_positionData.data();
+	m_texcoords = m_texcoordData.data();
+	m_indices = m_indexData.data();
+	m_vertexCount = uint32_t(m_positionData.size());
+	m_triangleCount = uint32_t(m_indexData.size() / 3);
 }
 
-bool Model::hit(const ray& ray, float t_min, float t_max, hit_record& record) const
+void Model::BuildBVH(const std::string& name)
 {
-	for (size_t i = 0; i < m_model.size(); i += 3)
+	auto start = std::chrono::high_resolution_clock::now();
+
+	const int triangleCount = TriangleCount();
+	std::vector<bvh_primitive> prims(triangleCount);
+	for (int i = 0; i < triangleCount; ++i)
+	{
+		const vec3& a = m_positions[m_indices[3 * i]];
+		const vec3& b = m_positions[m_indices[3 * i + 1]];
+		const vec3& c = m_positions[m_indices[3 * i + 2]];
+		vec3 lo(ffmin(a.x(), ffmin(b.x(), c.x())), ffmin(a.y(), ffmin(b.y(), c.y())), ffmin(a.z(), ffmin(b.z(), c.z())));
+		vec3 hi(ffmax(a.x(), ffmax(b.x(), c.x())), ffmax(a.y(), ffmax(b.y(), c.y())), ffmax(a.z(), ffmax(b.z(), c.z())));
+		prims[i].box = aabb(lo, hi);
+		prims[i].centroid = prims[i].box.centroid();
+		prims[i].index = i;
+	}
+
+	sampler rng;
+	m_bvh.build(prims, bvh_split::sah, rng);
+
+	// store the triangles in leaf order so a leaf reads one contiguous run
+	std::vector<uint32_t> ordered(m_indexData.size());
+	for (int i = 0; i < triangleCount; ++i)
 	{
-		bool result = rayTriangleIntersect(ray, t_min, t_max, record, m_model.at(i), m_model.at(i + 1), m_model.at(i + 2));
-		if (result) { return true; }
+		int src = m_bvh.indices[i];
+		ordered[3 * i] = m_indexData[3 * src];
+		ordered[3 * i + 1] = m_indexData[3 * src + 1];
+		ordered[3 * i + 2] = m_indexData[3 * src + 2];
 	}
+	m_indexData.swap(ordered);
+	m_indices = m_indexData.data();
+
+	if (m_precomputed)
+		m_triangles.Build(m_positions, m_indices, m_triangleCount);
+
+	m_bounds = m_bvh.root_bounds();
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << " - mesh " << name << " " << triangleCount << " triangles, " << m_vertexCount << " vertices"
+		<< ", bvh " << ms << " ms"
+		<< ", " << m_bvh.node_count << " nodes"
+		<< " (" << (triangleCount > 0 ? float(m_bvh.memory_bytes()) / triangleCount : 0.0f) << " bytes/tri)"
+		<< ", mesh " << MemoryBytes() / 1024 << " KB"
+		<< " (expanded vertices would be " << size_t(triangleCount) * 3 * 2 * sizeof(vec3) / 1024 << " KB)\n";
 }
 
-bool Model::bounding_box(float t0, float t1, aabb& box) const
+// Changes whenever an element type the cache stores verbatim changes size.
+uint32_t Model::CacheLayout() const
+{
+	return uint32_t(sizeof(vec3)) | uint32_t(sizeof(TexCoord)) << 8
+		| uint32_t(sizeof(linear_bvh_node)) << 16 | uint32_t(m_precomputed ? 1 : 0) << 24;
+}
+
+bool Model::WriteCache(const std::string& cachePath, const mesh_cache_key& key) const
+{
+	const uint32_t counts[4] = { m_vertexCount, m_triangleCount, uint32_t(m_bvh.node_count), 0 };
+	const mesh_cache_block blocks[5] = {
+		{ m_positions, m_vertexCount * sizeof(vec3) },
+		{ m_texcoords, m_vertexCount * sizeof(TexCoord) },
+		{ m_indices, m_triangleCount * 3 * sizeof(uint32_t) },
+		{ m_bvh.node_data, m_bvh.memory_bytes() },
+		{ m_triangles.data, m_precomputed ? m_triangles.MemoryBytes() : 0 },
+	};
+	return write_mesh_cache(cachePath, key, CacheLayout(), counts, blocks, 5);
+}
+
+bool Model::LoadCache(const std::string& cachePath, const mesh_cache_key& key)
 {
-	vec3 minVertex = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
-	vec3 maxVertex = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	std::unique_ptr<mapped_file> file(new mapped_file());
+	const mesh_cache_header* header = open_mesh_cache(cachePath, key, CacheLayout(), *file);
+	if (!header)
+		return false;
+
+	// every block must hold exactly what the counts say, and the indices and
+	// nodes must stay inside their arrays; anything else is parsed again
+	const uint64_t vertices = header->counts[0];
+	const uint64_t triangles = header->counts[1];
+	const uint64_t nodes = header->counts[2];
+	const uint64_t expected[5] = {
+		vertices * sizeof(vec3),
+		vertices * sizeof(TexCoord),
+		triangles * 3 * sizeof(uint32_t),
+		nodes * sizeof(linear_bvh_node),
+		m_precomputed ? triangles * 12 * sizeof(float) : 0,
+	};
+	for (int k = 0; k < 5; ++k)
+		if (header->block_size[k] != expected[k])
+			return false;
+	if (nodes > uint64_t(INT_MAX) || (triangles > 0) != (nodes > 0))
+		return false;
 
-	//Loop through the vertices describing the bounding box
-	for (const auto& Vert : m_model)
+	const unsigned char* base = file->data();
+	const uint32_t* indices = reinterpret_cast<const uint32_t*>(base + header->block_offset[2]);
+	for (uint64_t i = 0; i < triangles * 3; ++i)
+		if (indices[i] >= vertices)
+			return false;
+	// Children only come after their parent, so one pass in order sees every
+	// node's depth before its children. The traversal stacks hold
+	// bvh_max_depth levels; a deeper chain is rejected rather than overflowing
+	// them, and so is any node the root never reaches.
+	const linear_bvh_node* nodeData = reinterpret_cast<const linear_bvh_node*>(base + header->block_offset[3]);
+	std::vector<int> depth(size_t(nodes), -1);
+	if (nodes > 0)
+		depth[0] = 0;
+	for (uint64_t i = 0; i < nodes; ++i)
 	{
-		//Get the smallest vertex 
-		minVertex.e[0] = minVertex.e[0] < Vert.Position.e[0] ? minVertex.e[0] : Vert.Position.e[0];    // Find smallest x value in model
-		minVertex.e[1] = minVertex.e[1] < Vert.Position.e[1] ? minVertex.e[1] : Vert.Position.e[1];     // Find smallest y value in model
-		minVertex.e[2] = minVertex.e[2] < Vert.Position.e[2] ? minVertex.e[2] : Vert.Position.e[2];    // Find smallest z value in model
-
-		//Get the largest vertex 
-		maxVertex.e[0] = minVertex.e[0] > Vert.Position.e[0] ? minVertex.e[0] : Vert.Position.e[0];    // Find largest x value in model
-		maxVertex.e[1] = minVertex.e[1] > Vert.Position.e[1] ? minVertex.e[1] : Vert.Position.e[1];    // Find largest y value in model
-		maxVertex.e[2] = minVertex.e[2] > Vert.Position.e[2] ? minVertex.e[2] : Vert.Position.e[2];    // Find largest z value in model
+		const linear_bvh_node& node = nodeData[i];
+		bool inside = node.n_primitives > 0
+			? uint64_t(uint32_t(node.primitives_offset)) + node.n_primitives <= triangles
+			: node.second_child_offset > int(i) + 1 && uint64_t(node.second_child_offset) < nodes;
+		if (!inside || depth[i] < 0 || depth[i] >= bvh_max_depth)
+			return false;
+		if (node.n_primitives == 0)
+		{
+			depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+			depth[node.second_child_offset] = std::max(depth[node.second_child_offset], depth[i] + 1);
+		}
 	}
-	//create box
-	box = aabb(minVertex, maxVertex);
+
+	m_vertexCount = header->counts[0];
+	m_triangleCount = header->counts[1];
+	m_positions = reinterpret_cast<const vec3*>(base + header->block_offset[0]);
+	m_texcoords = reinterpret_cast<const TexCoord*>(base + header->block_offset[1]);
+	m_indices = reinterpret_cast<const uint32_t*>(base + header->block_offset[2]);
+	m_bvh.attach(reinterpret_cast<const linear_bvh_node*>(base + header->block_offset[3]), int(header->counts[2]));
+	if (m_precomputed)
+		m_triangles.Attach(reinterpret_cast<const float*>(base + header->block_offset[4]), m_triangleCount);
+	m_bounds = m_bvh.root_bounds();
+	m_cacheFile = std::move(file);
+	return true;
+}
+
+// Geometry only: positions, uvs, indices and the optional precomputed triangles.
+size_t Model::MemoryBytes() const
+{
+	return m_vertexCount * sizeof(vec3)
+		+ m_vertexCount * sizeof(TexCoord)
+		+ m_triangleCount * 3 * sizeof(uint32_t)
+		+ (m_precomputed ? m_triangles.MemoryBytes() : 0);
+}
+
+bool Model::hit(const ray& ray, float t_min, float t_max, hit_record& record) const
+{
+	// closest hit: every triangle hit shrinks t_max for the rest of the walk
+	int closest = -1;
+	float hitU = 0.0f;
+	float hitV = 0.0f;
+	m_bvh.traverse(ray, t_min, t_max, [&](int i, float tmin, float& tmax) {
+		float t, u, v;
+		if (rayTriangleIntersect(ray, i, tmin, tmax, t, u, v))
+		{
+			tmax = t;
+			record.t = t;
+			closest = i;
+			hitU = u;
+			hitV = v;
+			return true;
+		}
+		return false;
+		});
+	if (closest < 0)
+		return false;
+	FillRecord(ray, closest, record.t, hitU, hitV, record);
 	return true;
 }
 
-bool Model::rayTriangleIntersect(const ray& ray, float t_min, float t_max, hit_record& record, const Vertex& v0, const Vertex& v1, const Vertex& v2) const
+void Model::FillRecord(const ray& ray, int tri, float t, float u, float v, hit_record& record) const
+{
+	if (m_precomputed)
+	{
+		record.normal = vec3(m_triangles.nx[tri], m_triangles.ny[tri], m_triangles.nz[tri]);
+	}
+	else
+	{
+		const vec3& p0 = m_positions[m_indices[3 * tri]];
+		record.normal = unit_vector(cross(m_positions[m_indices[3 * tri + 1]] - p0, m_positions[m_indices[3 * tri + 2]] - p0));
+	}
+	record.t = t;
+	record.p = ray.point_at_parameter(record.t);
+	record.mat_ptr = m_material;
+	const TexCoord& uv0 = m_texcoords[m_indices[3 * tri]];
+	const TexCoord& uv1 = m_texcoords[m_indices[3 * tri + 1]];
+	const TexCoord& uv2 = m_texcoords[m_indices[3 * tri + 2]];
+	record.u = uv0.u * (1 - u - v) + uv1.u * u + uv2.u * v;
+	record.v = uv0.v * (1 - u - v) + uv1.v * u + uv2.v * v;
+}
+
+// Packets walk the mesh BVH together and test each triangle against all
+// their lanes at once; records are only filled for each lane's closest hit.
+int Model::hit4(const ray4& rays, int active, float t_min, float* t_max, hit_record* records) const
+{
+	if (!m_precomputed)
+		return hittable::hit4(rays, active, t_min, t_max, records);
+	int closest[4] = { -1, -1, -1, -1 };
+	float hitU[4], hitV[4];
+	m_bvh.traverse4(rays, active, t_min, t_max, [&](int i, int lanes) {
+		float4 t, u, v;
+		lanes &= rayTriangleIntersect4(rays, i, float4(t_min), float4::load(t_max), t, u, v);
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			if (lanes >> lane & 1)
+			{
+				t_max[lane] = t[lane];
+				closest[lane] = i;
+				hitU[lane] = u[lane];
+				hitV[lane] = v[lane];
+			}
+		}
+		});
+	int hits = 0;
+	for (int lane = 0; lane < 4; ++lane)
+	{
+		if (closest[lane] >= 0)
+		{
+			FillRecord(rays.rays[lane], closest[lane], t_max[lane], hitU[lane], hitV[lane], records[lane]);
+			hits |= 1 << lane;
+		}
+	}
+	return hits;
+}
+
+bool Model::bounding_box(float t0, float t1, aabb& box) const
+{
+	box = m_bounds;
+	return m_bvh.node_count > 0;
+}
+
+bool Model::rayTriangleIntersect(const ray& ray, int tri, float t_min, float t_max, float& t, float& u, float& v) const
 {
-	vec3 v0v1 = v1.Position - v0.Position;
-	vec3 v0v2 = v2.Position - v0.Position;
+	vec3 v0, v0v1, v0v2;
+	if (m_precomputed)
+	{
+		v0 = vec3(m_triangles.v0x[tri], m_triangles.v0y[tri], m_triangles.v0z[tri]);
+		v0v1 = vec3(m_triangles.e1x[tri], m_triangles.e1y[tri], m_triangles.e1z[tri]);
+		v0v2 = vec3(m_triangles.e2x[tri], m_triangles.e2y[tri], m_triangles.e2z[tri]);
+	}
+	else
+	{
+		v0 = m_positions[m_indices[3 * tri]];
+		v0v1 = m_positions[m_indices[3 * tri + 1]] - v0;
+		v0v2 = m_positions[m_indices[3 * tri + 2]] - v0;
+	}
 
 	vec3 pvec = cross(ray.direction(), v0v2);
 	float det = dot(v0v1, pvec);
@@ -133,28 +465,46 @@ bool Model::rayTriangleIntersect(const ray& ray, float t_min, float t_max, hit_r
 
 	float invDet = 1 / det;
 
-	vec3 tvec = ray.origin() - v0.Position;
-	float u = dot(tvec, pvec) * invDet;
+	vec3 tvec = ray.origin() - v0;
+	u = dot(tvec, pvec) * invDet;
 	if (u < 0 || u > 1) return false;
 
 	vec3 qvec = cross(tvec, v0v1);
-	float v = dot(ray.direction(), qvec) * invDet;
+	v = dot(ray.direction(), qvec) * invDet;
 	if (v < 0 || u + v > 1) return false;
 
-	float temp = dot(v0v2, qvec) * invDet;
-	if (temp < t_max && temp > t_min)
-	{
-		record.t = temp;
-		record.p = ray.point_at_parameter(record.t);
-		record.normal = cross(v0v1, v0v2);
-		record.normal.make_unit_vector();
-		record.mat_ptr = m_material;
-		vec3 out_tex_coords = v0.TexCoord * (1 - u - v) + v1.TexCoord * u + v2.TexCoord * v;
-		record.u = out_tex_coords.e[0];
-		record.v = out_tex_coords.e[1];
-		return true;
-	}
-	return false;
+	t = dot(v0v2, qvec) * invDet;
+	return t < t_max && t > t_min;
+}
+
+int Model::rayTriangleIntersect4(const ray4& rays, int tri, float4 t_min, float4 t_max, float4& t, float4& u, float4& v) const
+{
+	float4 v0x(m_triangles.v0x[tri]), v0y(m_triangles.v0y[tri]), v0z(m_triangles.v0z[tri]);
+	float4 e1x(m_triangles.e1x[tri]), e1y(m_triangles.e1y[tri]), e1z(m_triangles.e1z[tri]);
+	float4 e2x(m_triangles.e2x[tri]), e2y(m_triangles.e2y[tri]), e2z(m_triangles.e2z[tri]);
+
+	float4 px = rays.dy * e2z - rays.dz * e2y;
+	float4 py = rays.dz * e2x - rays.dx * e2z;
+	float4 pz = rays.dx * e2y - rays.dy * e2x;
+	float4 det = e1x * px + e1y * py + e1z * pz;
+	int lanes = ~(det < float4(FLT_EPSILON)) & 15;
+	if (!lanes) return 0;
+
+	float4 invDet = float4(1.0f) / det;
+
+	float4 tx = rays.ox - v0x, ty = rays.oy - v0y, tz = rays.oz - v0z;
+	u = (tx * px + ty * py + tz * pz) * invDet;
+	lanes &= ~((u < float4(0.0f)) | (u > float4(1.0f)));
+	if (!lanes) return 0;
+
+	float4 qx = ty * e1z - tz * e1y;
+	float4 qy = tz * e1x - tx * e1z;
+	float4 qz = tx * e1y - ty * e1x;
+	v = (rays.dx * qx + rays.dy * qy + rays.dz * qz) * invDet;
+	lanes &= ~((v < float4(0.0f)) | (u + v > float4(1.0f)));
+	if (!lanes) return 0;
 
+	t = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+	return lanes & (t < t_max) & (t > t_min);
 }
 #endif // !MODELH
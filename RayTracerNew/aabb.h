@@ -1,6 +1,7 @@
 #pragma once
 #ifndef AABBH
 #define AABBH
+#include <cfloat>
 #include "hittable.h"
 #include "ray.h"
 
@@ -14,26 +15,68 @@ public:
 
     vec3 min() const { return _min; }
     vec3 max() const { return _max; }
+    vec3 centroid() const { return 0.5f * (_min + _max); }
 
-    bool hit(const ray& r, float tmin, float tmax) const {
-        for (int a = 0; a < 3; a++) {
-            float t0 = ffmin((_min[a] - r.origin()[a]) / r.direction()[a],
-                (_max[a] - r.origin()[a]) / r.direction()[a]);
-            float t1 = ffmax((_min[a] - r.origin()[a]) / r.direction()[a],
-                (_max[a] - r.origin()[a]) / r.direction()[a]);
-            tmin = ffmax(t0, tmin);
-            tmax = ffmin(t1, tmax);
-            if (tmax <= tmin)
-                return false;
-        }
-        return true;
+    float surface_area() const {
+        vec3 d = _max - _min;
+        return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
     }
 
+    bool hit(const ray& r, float tmin, float tmax) const;
+
     vec3 _min;
     vec3 _max;
 };
 
-aabb surrounding_box(aabb box0, aabb box1) {
+// Rounding in (plane - origin) * inv_dir can put the far plane a little
+// too near; widening it by 1 + 2 gamma(3) (pbrt's bound) keeps the test
+// from missing boxes a ray only grazes.
+const float slab_far_scale = 1.0f + 2.0f * (3.0f * 0.5f * FLT_EPSILON) / (1.0f - 3.0f * 0.5f * FLT_EPSILON);
+
+// Slab test on raw bounds so the flattened BVH nodes can share it with aabb.
+// The ray's sign bits pick the near and far plane of each slab, so this is
+// three multiplies and min/max per axis with no divisions or branches. When
+// a direction component is zero and the origin lies on a plane the product
+// is NaN; ffmax/ffmin then keep tmin/tmax, treating the ray as inside.
+inline bool slab_hit(const float* bmin, const float* bmax, const ray& r, float tmin, float tmax) {
+    const float* planes[2] = { bmin, bmax };
+    for (int a = 0; a < 3; a++) {
+        float t0 = (planes[r.sign[a]][a] - r.A[a]) * r.inv_dir[a];
+        float t1 = (planes[1 - r.sign[a]][a] - r.A[a]) * r.inv_dir[a] * slab_far_scale;
+        tmin = ffmax(t0, tmin);
+        tmax = ffmin(t1, tmax);
+    }
+    // strict, so flat boxes around axis aligned triangles still get hit
+    return !(tmax < tmin);
+}
+
+// slab_hit() for the four lanes of a packet; returns the lanes that hit and
+// optionally where each lane enters the box. The lanes may point different
+// ways, so near and far are sorted with min/max instead of the sign bits.
+// In a NaN lane the other plane is at +-inf, which a plain min/max would
+// pick. Clamping lo and passing hi last makes near and far NaN or
+// FLT_MAX wide instead, so the lane keeps tmin/tmax like slab_hit().
+inline int slab_hit4(const float* bmin, const float* bmax, const ray4& r, float4 tmin, float4 tmax, float4* entry = nullptr) {
+    const float4* origin[3] = { &r.ox, &r.oy, &r.oz };
+    const float4* inv_dir[3] = { &r.ix, &r.iy, &r.iz };
+    const float4 far_scale(slab_far_scale);
+    const float4 big(FLT_MAX);
+    for (int a = 0; a < 3; a++) {
+        float4 lo = (float4(bmin[a]) - *origin[a]) * *inv_dir[a];
+        float4 hi = (float4(bmax[a]) - *origin[a]) * *inv_dir[a];
+        tmin = vmax(vmin(vmax(lo, -big), hi), tmin);
+        tmax = vmin(vmax(vmin(lo, big), hi) * far_scale, tmax);
+    }
+    if (entry)
+        *entry = tmin;
+    return ~(tmax < tmin) & 15;
+}
+
+inline bool aabb::hit(const ray& r, float tmin, float tmax) const {
+    return slab_hit(_min.e, _max.e, r, tmin, tmax);
+}
+
+aabb surrounding_box(const aabb& box0, const aabb& box1) {
     vec3 small(ffmin(box0.min().x(), box1.min().x()),
         ffmin(box0.min().y(), box1.min().y()),
         ffmin(box0.min().z(), box1.min().z()));
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef ADAPTIVEH
+#define ADAPTIVEH
+
+#include <cfloat>
+#include "vec3.h"
+
+struct adaptive_settings {
+    bool enabled = false;
+    int min_spp = 16;          // first batch every pixel gets
+    int batch_spp = 16;        // samples added per round after that
+    int max_spp = 512;
+    // half width of the 95% confidence interval on the displayed (gamma 2)
+    // luminance, in [0, 1] output units, below which a pixel is done
+    float threshold = 0.03f;
+};
+
+// Accumulated samples of one pixel plus the running variance of their
+// luminance (Welford's method), used to decide when adaptive sampling stops.
+struct pixel_estimate {
+    int n = 0;
+    vec3 sum = vec3(0, 0, 0);
+    float luminance_mean = 0;
+    float luminance_m2 = 0;
+
+    vec3 mean() const { return n > 0 ? sum / float(n) : vec3(0, 0, 0); }
+
+    void add(const vec3& sample) {
+        n++;
+        sum += sample;
+        float y = 0.2126f * sample.r() + 0.7152f * sample.g() + 0.0722f * sample.b();
+        float delta = y - luminance_mean;
+        luminance_mean += delta / float(n);
+        luminance_m2 += delta * (y - luminance_mean);
+    }
+
+    // Confidence interval of the mean taken through the sqrt used for
+    // display, d(sqrt(y)) = dy / (2 sqrt(y)): the same noise is far more
+    // visible in a dark corner than next to the light.
+    float display_error() const {
+        if (n < 2)
+            return FLT_MAX;
+        float variance = luminance_m2 / float(n - 1);
+        float interval = 1.96f * sqrt(variance / float(n));
+        float y = luminance_mean > 1e-4f ? luminance_mean : 1e-4f;
+        return interval / (2 * sqrt(y));
+    }
+
+    bool converged(const adaptive_settings& settings) const {
+        return n >= settings.min_spp && display_error() <= settings.threshold;
+    }
+};
+
+#endif
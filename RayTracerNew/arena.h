@@ -0,0 +1,101 @@
+#pragma once
+#ifndef ARENAH
+#define ARENAH
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Monotonic bump allocator that owns a scene. Objects are placed one after
+// another in large blocks, in the order they are made, and are never freed
+// one by one. Only types with a non-trivial destructor (anything holding a
+// std::vector, say) are recorded for cleanup, so dropping a scene of plain
+// primitives is a handful of free() calls however many objects it has.
+class arena {
+public:
+    explicit arena(size_t block_size = size_t(1) << 20) : block_size(block_size) {}
+    ~arena();
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    void* allocate(size_t size, size_t align);
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+            on_release([](void* p) { static_cast<T*>(p)->~T(); }, object);
+        objects++;
+        return object;
+    }
+
+    // Uninitialised storage for n trivially copyable values.
+    template <typename T>
+    T* make_array(size_t n, size_t align = alignof(T)) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena arrays are never destroyed");
+        return static_cast<T*>(allocate(sizeof(T) * n, align));
+    }
+
+    // Calls release(p) when the arena goes, e.g. to free image data
+    // allocated elsewhere.
+    void on_release(void (*release)(void*), void* p);
+
+    size_t bytes_used() const { return used; }
+    size_t bytes_reserved() const { return reserved; }
+    size_t object_count() const { return objects; }
+    size_t block_count() const { return blocks.size(); }
+
+private:
+    struct cleanup {
+        void (*release)(void*);
+        void* object;
+        cleanup* next;
+    };
+
+    size_t block_size;
+    std::vector<void*> blocks;
+    char* cursor = nullptr;
+    char* end = nullptr;
+    cleanup* cleanups = nullptr;
+    size_t used = 0;
+    size_t reserved = 0;
+    size_t objects = 0;
+};
+
+arena::~arena() {
+    // newest first, so nothing outlives what it was built from
+    for (cleanup* c = cleanups; c; c = c->next)
+        c->release(c->object);
+    for (void* block : blocks)
+        free(block);
+}
+
+void* arena::allocate(size_t size, size_t align) {
+    uintptr_t p = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~uintptr_t(align - 1);
+    if (!cursor || p + size > reinterpret_cast<uintptr_t>(end)) {
+        // anything bigger than a block gets a block of its own
+        size_t capacity = size + align > block_size ? size + align : block_size;
+        void* block = malloc(capacity);
+        if (!block)
+            throw std::bad_alloc();
+        blocks.push_back(block);
+        reserved += capacity;
+        cursor = static_cast<char*>(block);
+        end = cursor + capacity;
+        p = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~uintptr_t(align - 1);
+    }
+    used += p + size - reinterpret_cast<uintptr_t>(cursor);
+    cursor = reinterpret_cast<char*>(p + size);
+    return reinterpret_cast<void*>(p);
+}
+
+void arena::on_release(void (*release)(void*), void* p) {
+    cleanup* c = new (allocate(sizeof(cleanup), alignof(cleanup))) cleanup{ release, p, cleanups };
+    cleanups = c;
+}
+
+#endif
@@ -3,9 +3,11 @@
 #define BOXH
 
 #include "rectangle.h"
-#include "bvh.h"
 
 
+// The six faces are stored in the box itself rather than allocated one by
+// one behind BVH nodes; testing six rects in a row is cheaper than walking
+// a tree over them. The faces at p0 have their normals flipped to point out.
 class box : public hittable {
 public:
     box() {}
@@ -16,24 +18,34 @@ public:
         return true;
     }
     vec3 pmin, pmax;
-    hittable* list_ptr;
+    xy_rect xy[2];
+    xz_rect xz[2];
+    yz_rect yz[2];
 };
 
 box::box(const vec3& p0, const vec3& p1, material* ptr) {
     pmin = p0;
     pmax = p1;
-    hittable** list = new hittable * [6];
-    list[0] = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
-    list[1] = new flip_normals(new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
-    list[2] = new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
-    list[3] = new flip_normals(new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
-    list[4] = new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
-    list[5] = new flip_normals(new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
-    list_ptr = new bvh_node(list, 6, 0, 1);
+    xy[0] = xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
+    xy[1] = xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr);
+    xz[0] = xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
+    xz[1] = xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr);
+    yz[0] = yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
+    yz[1] = yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr);
 }
 
 bool box::hit(const ray& r, float t0, float t1, hit_record& rec) const {
-    return list_ptr->hit(r, t0, t1, rec);
+    const hittable* faces[6] = { &xy[0], &xy[1], &xz[0], &xz[1], &yz[0], &yz[1] };
+    int closest = -1;
+    for (int i = 0; i < 6; i++) {
+        if (faces[i]->hit(r, t0, t1, rec)) {
+            closest = i;
+            t1 = rec.t;
+        }
+    }
+    if (closest >= 0 && (closest & 1))
+        rec.normal = -rec.normal;
+    return closest >= 0;
 }
 
 #endif // !BOXH
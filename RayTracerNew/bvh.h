@@ -3,114 +3,836 @@
 #define BVHH
 
 #include "hittable.h"
+#include "hittablelist.h"
 #include "random.h"
+#include "arena.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
 
-class bvh_node : public hittable {
-public:
-    bvh_node() {}
-    bvh_node(hittable** l, int n, float time0, float time1);
-    virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
-    virtual bool bounding_box(float t0, float t1, aabb& box) const;
-    hittable* left;
-    hittable* right;
+
+// Near-first child ordering. Off visits children in build order, for
+// before/after comparisons.
+bool bvh_ordered_traversal = true;
+
+// Collapse flattened trees into four-wide nodes once built and trace single
+// rays and packets through those. Off keeps to the binary nodes; trees
+// built while it was on keep both.
+bool bvh_wide = true;
+
+// Nodes whose box was tested, summed per thread.
+struct bvh_counters {
+    uint64_t nodes_visited = 0;
+};
+thread_local bvh_counters bvh_stats;
+
+
+enum class bvh_split { median, sah };
+
+// Which builder build_bvh() uses; flip to median to compare against the
+// original random-axis split.
+bvh_split bvh_default_split = bvh_split::sah;
+
+// Relative costs used by the surface area heuristic. A node visit is one
+// slab test, a primitive test is a virtual hit() call.
+const float bvh_traversal_cost = 0.5f;
+const float bvh_intersect_cost = 1.0f;
+const int bvh_sah_bins = 16;
+const int bvh_max_leaf_size = 4;
+const int bvh_max_depth = 64;
+
+// SAH builds hand subtrees of at least bvh_parallel_min primitives to tasks
+// of their own, on up to bvh_build_threads threads (0: one per core). Each
+// such subtree gets a sampler seeded from its primitive range and its nodes
+// are appended in depth first order, so the tree is the same however many
+// threads build it.
+int bvh_build_threads = 0;
+const int bvh_parallel_min = 4096;
+
+// Refitting keeps a tree's topology, so its SAH cost drifts as primitives
+// move. Past this multiple of the cost it was built with, refit() callers
+// rebuild instead.
+float bvh_refit_limit = 1.5f;
+
+inline int bvh_thread_count() {
+    return bvh_build_threads > 0 ? bvh_build_threads : int(std::max(1u, std::thread::hardware_concurrency()));
+}
+
+struct bvh_primitive {
     aabb box;
+    vec3 centroid;
+    int index;
+};
+
+// 32 bytes, two nodes per cache line. Nodes are stored depth first, so the
+// first child of an interior node always sits right after it and only the
+// second child needs an offset.
+struct linear_bvh_node {
+    float bmin[3];
+    float bmax[3];
+    union {
+        int primitives_offset;    // leaf
+        int second_child_offset;  // interior
+    };
+    uint16_t n_primitives;        // 0 for interior nodes
+    uint8_t axis;
+    uint8_t pad;
 };
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should stay 32 bytes");
 
+// Up to four children of a collapsed node, their bounds stored axis by axis
+// so one SIMD slab test covers all of them; bounds[0] holds the minimum
+// planes and bounds[1] the maximum, so a ray's sign bits index its near and
+// far planes. Leaf children refer to the same primitive ranges as the binary
+// leaves they came from. 128 bytes.
+struct bvh4_node {
+    float bounds[2][3][4];
+    int child[4];               // bvh4 node index, or first primitive of a leaf
+    uint16_t n_primitives[4];   // 0 for interior children
+    int n_children;
+    int pad;
+};
+static_assert(sizeof(bvh4_node) == 128, "bvh4_node should stay 128 bytes");
+
+// Geometry agnostic flattened BVH. Whoever owns the primitives reorders them
+// with `indices` after build(), so leaves refer to a contiguous range
+// [primitives_offset, primitives_offset + n_primitives) of that array.
+class bvh_tree {
+public:
+    void build(std::vector<bvh_primitive>& prims, bvh_split method, sampler& rng);
+    // Traverse nodes owned by someone else, e.g. a mapped mesh cache.
+    void attach(const linear_bvh_node* data, int count);
+    // Builds `wide` from the binary nodes.
+    void collapse();
+    // Recomputes every bound bottom-up with primitive_box(int i, aabb& box)
+    // for the primitive at leaf position i, keeping the topology, then
+    // collapses again. Only trees built here are refit, not attached ones.
+    template <typename F>
+    void refit(F&& primitive_box);
+    // whether refits have made the tree worse than bvh_refit_limit allows
+    bool degraded() const { return sah_cost() > build_cost * bvh_refit_limit; }
+    float sah_cost() const;
+    aabb root_bounds() const;
+    // the binary node array, as the mesh cache stores it
+    size_t memory_bytes() const { return size_t(node_count) * sizeof(linear_bvh_node); }
+    size_t wide_bytes() const { return wide.size() * sizeof(bvh4_node); }
+
+    // hit_primitive(int i, float t_min, float& t_max) tests primitive i and
+    // shrinks t_max to the new closest hit; returns true on a hit.
+    template <typename F>
+    bool traverse(const ray& r, float t_min, float t_max, F&& hit_primitive) const;
+    // Packet version: a node is entered when any of its lanes hits the box
+    // and only those lanes go on into it. hit_primitives(int i, int lanes)
+    // tests primitive i for those lanes, shrinking their t_max on a hit.
+    template <typename F>
+    void traverse4(const ray4& r, int active, float t_min, float* t_max, F&& hit_primitives) const;
+
+    std::vector<linear_bvh_node> nodes;
+    std::vector<int> indices;
+
+    // What traversal reads: nodes.data() after build(), or attached memory.
+    const linear_bvh_node* node_data = nullptr;
+    int node_count = 0;
+    std::vector<bvh4_node> wide;
+    float build_cost = 0.0f;    // sah_cost() when last built
+
+private:
+    int collapse_recursive(int node);
+    template <typename F>
+    bool traverse_wide(const ray& r, float t_min, float t_max, F&& hit_primitive) const;
+    template <typename F>
+    void traverse4_wide(const ray4& r, int active, float t_min, float* t_max, F&& hit_primitives) const;
+    // threads a build may start besides its own
+    struct build_slots {
+        std::atomic<int> free;
+        bool take() {
+            int n = free.load();
+            while (n > 0)
+                if (free.compare_exchange_weak(n, n - 1))
+                    return true;
+            return false;
+        }
+    };
+
+    int build_recursive(std::vector<linear_bvh_node>& out, bvh_primitive* prims, int begin, int end, int depth,
+                        bvh_split method, sampler& rng, build_slots& slots) const;
+    int sah_split(bvh_primitive* prims, int n, const aabb& bounds, const aabb& centroid_bounds, int& axis) const;
+};
+
+// Returns the size of the left half, or 0 if the range should stay a leaf.
+int bvh_tree::sah_split(bvh_primitive* prims, int n, const aabb& bounds, const aabb& centroid_bounds, int& axis_out) const {
+    float leaf_cost = bvh_intersect_cost * n;
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    int best_bin = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float cmin = centroid_bounds.min()[axis];
+        float extent = centroid_bounds.max()[axis] - cmin;
+        if (extent <= 0.0f)
+            continue;
+
+        int counts[bvh_sah_bins] = {};
+        aabb bin_boxes[bvh_sah_bins];
+        for (int i = 0; i < n; i++) {
+            int b = std::min(bvh_sah_bins - 1, int(bvh_sah_bins * (prims[i].centroid[axis] - cmin) / extent));
+            bin_boxes[b] = counts[b]++ ? surrounding_box(bin_boxes[b], prims[i].box) : prims[i].box;
+        }
 
-bool bvh_node::bounding_box(float t0, float t1, aabb& b) const {
-    b = box;
-    return true;
+        // sweep from the right to get the area and count above every plane
+        float right_area[bvh_sah_bins];
+        int right_count[bvh_sah_bins];
+        aabb acc;
+        int count = 0;
+        for (int b = bvh_sah_bins - 1; b > 0; b--) {
+            if (counts[b])
+                acc = count ? surrounding_box(acc, bin_boxes[b]) : bin_boxes[b];
+            count += counts[b];
+            right_area[b] = count ? acc.surface_area() : 0.0f;
+            right_count[b] = count;
+        }
+
+        count = 0;
+        for (int b = 0; b < bvh_sah_bins - 1; b++) {
+            if (counts[b])
+                acc = count ? surrounding_box(acc, bin_boxes[b]) : bin_boxes[b];
+            count += counts[b];
+            if (count == 0 || right_count[b + 1] == 0)
+                continue;
+            float cost = bvh_traversal_cost + bvh_intersect_cost *
+                (count * acc.surface_area() + right_count[b + 1] * right_area[b + 1]) / bounds.surface_area();
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    if (best_axis < 0) {
+        // every centroid is in the same spot, binning can't separate them
+        axis_out = 0;
+        return n <= bvh_max_leaf_size ? 0 : n / 2;
+    }
+    if (n <= bvh_max_leaf_size && leaf_cost <= best_cost)
+        return 0;
+
+    axis_out = best_axis;
+    float cmin = centroid_bounds.min()[best_axis];
+    float extent = centroid_bounds.max()[best_axis] - cmin;
+    bvh_primitive* split = std::partition(prims, prims + n, [=](const bvh_primitive& p) {
+        int b = std::min(bvh_sah_bins - 1, int(bvh_sah_bins * (p.centroid[best_axis] - cmin) / extent));
+        return b <= best_bin;
+    });
+    return int(split - prims);
 }
 
-bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-    if (box.hit(r, t_min, t_max)) {
-        hit_record left_rec, right_rec;
-        bool hit_left = left->hit(r, t_min, t_max, left_rec);
-        bool hit_right = right->hit(r, t_min, t_max, right_rec);
-        if (hit_left && hit_right) {
-            if (left_rec.t < right_rec.t)
-                rec = left_rec;
-            else
-                rec = right_rec;
-            return true;
+// Appends the subtree over prims[begin, end) to `out` and returns the index
+// of its root there; child offsets are relative to the start of `out`.
+int bvh_tree::build_recursive(std::vector<linear_bvh_node>& out, bvh_primitive* prims, int begin, int end, int depth,
+                              bvh_split method, sampler& rng, build_slots& slots) const {
+    int n = end - begin;
+    aabb bounds = prims[begin].box;
+    aabb centroid_bounds(prims[begin].centroid, prims[begin].centroid);
+    for (int i = begin + 1; i < end; i++) {
+        bounds = surrounding_box(bounds, prims[i].box);
+        centroid_bounds = surrounding_box(centroid_bounds, aabb(prims[i].centroid, prims[i].centroid));
+    }
+
+    int index = int(out.size());
+    out.emplace_back();
+    for (int a = 0; a < 3; a++) {
+        out[index].bmin[a] = bounds.min()[a];
+        out[index].bmax[a] = bounds.max()[a];
+    }
+    out[index].axis = 0;
+    out[index].pad = 0;
+
+    int axis = 0;
+    int mid = 0;
+    if (n > 1) {
+        if (method == bvh_split::sah && depth < bvh_max_depth / 2) {
+            mid = sah_split(prims + begin, n, bounds, centroid_bounds, axis);
         }
-        else if (hit_left) {
-            rec = left_rec;
-            return true;
+        else {
+            // the original builder: random axis, split at the median. Also
+            // caps the depth of lopsided SAH trees so the traversal stack holds.
+            axis = int(3 * rng.next_float());
+            mid = n / 2;
+            std::nth_element(prims + begin, prims + begin + mid, prims + end,
+                [axis](const bvh_primitive& a, const bvh_primitive& b) {
+                    return a.box.min()[axis] < b.box.min()[axis];
+                });
         }
-        else if (hit_right) {
-            rec = right_rec;
-            return true;
+    }
+
+    if (mid == 0) {
+        out[index].primitives_offset = begin;
+        out[index].n_primitives = uint16_t(n);
+        return index;
+    }
+
+    int second;
+    if (method == bvh_split::sah && n >= bvh_parallel_min) {
+        sampler second_rng(hash_seed(begin + mid, end));
+        if (slots.take()) {
+            // the halves share no primitives; another thread builds the
+            // second into an array of its own, appended once both are done
+            std::vector<linear_bvh_node> second_nodes;
+            std::future<void> task = std::async(std::launch::async, [&]() {
+                build_recursive(second_nodes, prims, begin + mid, end, depth + 1, method, second_rng, slots);
+            });
+            build_recursive(out, prims, begin, begin + mid, depth + 1, method, rng, slots);
+            // this thread idles until the task is done and then takes over
+            // the task's slot, so its core can go to another subtree meanwhile
+            slots.free++;
+            task.get();
+            second = int(out.size());
+            for (linear_bvh_node& node : second_nodes)
+                if (node.n_primitives == 0)
+                    node.second_child_offset += second;
+            out.insert(out.end(), second_nodes.begin(), second_nodes.end());
+        }
+        else {
+            build_recursive(out, prims, begin, begin + mid, depth + 1, method, rng, slots);
+            second = build_recursive(out, prims, begin + mid, end, depth + 1, method, second_rng, slots);
+        }
+    }
+    else {
+        build_recursive(out, prims, begin, begin + mid, depth + 1, method, rng, slots);
+        second = build_recursive(out, prims, begin + mid, end, depth + 1, method, rng, slots);
+    }
+    out[index].second_child_offset = second;
+    out[index].n_primitives = 0;
+    out[index].axis = uint8_t(axis);
+    return index;
+}
+
+void bvh_tree::build(std::vector<bvh_primitive>& prims, bvh_split method, sampler& rng) {
+    nodes.clear();
+    indices.clear();
+    node_data = nullptr;
+    node_count = 0;
+    if (prims.empty())
+        return;
+    nodes.reserve(2 * prims.size());
+    build_slots slots;
+    slots.free = bvh_thread_count() - 1;
+    build_recursive(nodes, prims.data(), 0, int(prims.size()), 0, method, rng, slots);
+    indices.resize(prims.size());
+    for (size_t i = 0; i < prims.size(); i++)
+        indices[i] = prims[i].index;
+    node_data = nodes.data();
+    node_count = int(nodes.size());
+    build_cost = sah_cost();
+    collapse();
+}
+
+void bvh_tree::attach(const linear_bvh_node* data, int count) {
+    nodes.clear();
+    indices.clear();
+    node_data = data;
+    node_count = count;
+    build_cost = 0.0f;
+    collapse();
+}
+
+template <typename F>
+void bvh_tree::refit(F&& primitive_box) {
+    if (nodes.empty())
+        return;
+    // children always come after their parent, so walking the array
+    // backwards sees both children of a node before the node itself
+    for (int i = int(nodes.size()) - 1; i >= 0; i--) {
+        linear_bvh_node& node = nodes[i];
+        aabb box;
+        if (node.n_primitives > 0) {
+            primitive_box(node.primitives_offset, box);
+            for (int k = 1; k < node.n_primitives; k++) {
+                aabb next;
+                primitive_box(node.primitives_offset + k, next);
+                box = surrounding_box(box, next);
+            }
+            for (int a = 0; a < 3; a++) {
+                node.bmin[a] = box.min()[a];
+                node.bmax[a] = box.max()[a];
+            }
+        }
+        else {
+            const linear_bvh_node& first = nodes[i + 1];
+            const linear_bvh_node& second = nodes[node.second_child_offset];
+            for (int a = 0; a < 3; a++) {
+                node.bmin[a] = ffmin(first.bmin[a], second.bmin[a]);
+                node.bmax[a] = ffmax(first.bmax[a], second.bmax[a]);
+            }
         }
+    }
+    collapse();
+}
+
+inline float node_surface_area(const linear_bvh_node& node) {
+    float dx = node.bmax[0] - node.bmin[0];
+    float dy = node.bmax[1] - node.bmin[1];
+    float dz = node.bmax[2] - node.bmin[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+void bvh_tree::collapse() {
+    wide.clear();
+    if (!bvh_wide || node_count == 0)
+        return;
+    wide.reserve(node_count / 3 + 1);
+    collapse_recursive(0);
+}
+
+// Starts from `node` alone and keeps opening the interior child with the
+// largest surface area until there are four children or only leaves.
+int bvh_tree::collapse_recursive(int node) {
+    int index = int(wide.size());
+    wide.emplace_back();
+    int children[4] = { node };
+    int n = 1;
+    while (n < 4) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int k = 0; k < n; k++) {
+            const linear_bvh_node& c = node_data[children[k]];
+            if (c.n_primitives == 0 && node_surface_area(c) > best_area) {
+                best = k;
+                best_area = node_surface_area(c);
+            }
+        }
+        if (best < 0)
+            break;
+        int opened = children[best];
+        children[best] = opened + 1;
+        children[n++] = node_data[opened].second_child_offset;
+    }
+
+    bvh4_node out = {};
+    out.n_children = n;
+    for (int k = 0; k < 4; k++) {
+        // unused slots get an empty box no ray can hit
+        for (int a = 0; a < 3; a++) {
+            out.bounds[0][a][k] = k < n ? node_data[children[k]].bmin[a] : FLT_MAX;
+            out.bounds[1][a][k] = k < n ? node_data[children[k]].bmax[a] : -FLT_MAX;
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        const linear_bvh_node& c = node_data[children[k]];
+        out.n_primitives[k] = c.n_primitives;
+        out.child[k] = c.n_primitives > 0 ? c.primitives_offset : collapse_recursive(children[k]);
+    }
+    wide[index] = out;
+    return index;
+}
+
+aabb bvh_tree::root_bounds() const {
+    if (node_count == 0)
+        return aabb(vec3(0, 0, 0), vec3(0, 0, 0));
+    const linear_bvh_node& root = node_data[0];
+    return aabb(vec3(root.bmin[0], root.bmin[1], root.bmin[2]), vec3(root.bmax[0], root.bmax[1], root.bmax[2]));
+}
+
+// Expected cost of a random ray through the tree, relative to the root box.
+float bvh_tree::sah_cost() const {
+    if (node_count == 0)
+        return 0.0f;
+    float root_area = node_surface_area(node_data[0]);
+    float cost = 0.0f;
+    for (int i = 0; i < node_count; i++) {
+        const linear_bvh_node& node = node_data[i];
+        float area = node_surface_area(node) / root_area;
+        if (node.n_primitives > 0)
+            cost += bvh_intersect_cost * area * node.n_primitives;
         else
-            return false;
+            cost += bvh_traversal_cost * area;
     }
-    else return false;
+    return cost;
 }
 
+template <typename F>
+bool bvh_tree::traverse(const ray& r, float t_min, float t_max, F&& hit_primitive) const {
+    if (node_count == 0)
+        return false;
+    if (bvh_wide && !wide.empty())
+        return traverse_wide(r, t_min, t_max, hit_primitive);
+    bool hit_anything = false;
+    const int* dir_is_neg = r.sign;
+    int stack[bvh_max_depth];
+    int stack_size = 0;
+    int current = 0;
+    uint64_t visited = 0;
+    while (true) {
+        const linear_bvh_node& node = node_data[current];
+        visited++;
+        // t_max shrinks with every hit, so boxes behind the closest hit so
+        // far fail the slab test and their whole subtree is skipped
+        if (slab_hit(node.bmin, node.bmax, r, t_min, t_max)) {
+            if (node.n_primitives > 0) {
+                for (int i = 0; i < node.n_primitives; i++)
+                    if (hit_primitive(node.primitives_offset + i, t_min, t_max))
+                        hit_anything = true;
+            }
+            else {
+                // descend into the child on the near side of the split plane
+                if (bvh_ordered_traversal && dir_is_neg[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.second_child_offset;
+                }
+                else {
+                    stack[stack_size++] = node.second_child_offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+    bvh_stats.nodes_visited += visited;
+    return hit_anything;
+}
 
-int box_x_compare(const void* a, const void* b) {
-    aabb box_left, box_right;
-    hittable* ah = *(hittable**)a;
-    hittable* bh = *(hittable**)b;
-    if (!ah->bounding_box(0, 0, box_left) || !bh->bounding_box(0, 0, box_right))
-        std::cerr << "no bounding box in bvh_node constructor\n";
-    if (box_left.min().x() - box_right.min().x() < 0.0)
-        return -1;
-    else
-        return 1;
-}
-
-int box_y_compare(const void* a, const void* b)
-{
-    aabb box_left, box_right;
-    hittable* ah = *(hittable**)a;
-    hittable* bh = *(hittable**)b;
-    if (!ah->bounding_box(0, 0, box_left) || !bh->bounding_box(0, 0, box_right))
-        std::cerr << "no bounding box in bvh_node constructor\n";
-    if (box_left.min().y() - box_right.min().y() < 0.0)
-        return -1;
-    else
-        return 1;
-}
-int box_z_compare(const void* a, const void* b)
-{
-    aabb box_left, box_right;
-    hittable* ah = *(hittable**)a;
-    hittable* bh = *(hittable**)b;
-    if (!ah->bounding_box(0, 0, box_left) || !bh->bounding_box(0, 0, box_right))
-        std::cerr << "no bounding box in bvh_node constructor\n";
-    if (box_left.min().z() - box_right.min().z() < 0.0)
-        return -1;
-    else
-        return 1;
+// One slab test for all four children of a wide node. Hit children are
+// visited nearest entry first; the others wait on the stack with their
+// entry distance and are dropped if a closer hit turns up meanwhile.
+template <typename F>
+bool bvh_tree::traverse_wide(const ray& r, float t_min, float t_max, F&& hit_primitive) const {
+    struct entry {
+        int index;
+        int count;      // primitives of a leaf, 0 for a wide node
+        float t;
+    };
+    const float4 origin[3] = { float4(r.A[0]), float4(r.A[1]), float4(r.A[2]) };
+    const float4 inv_dir[3] = { float4(r.inv_dir[0]), float4(r.inv_dir[1]), float4(r.inv_dir[2]) };
+    const float4 far_scale(slab_far_scale);
+    bool hit_anything = false;
+    entry stack[3 * bvh_max_depth + 1];
+    int stack_size = 0;
+    entry current = { 0, 0, t_min };
+    uint64_t visited = 0;
+    while (true) {
+        if (current.count > 0) {
+            for (int i = 0; i < current.count; i++)
+                if (hit_primitive(current.index + i, t_min, t_max))
+                    hit_anything = true;
+        }
+        else {
+            const bvh4_node& node = wide[current.index];
+            visited++;
+            float4 tmin(t_min), tmax(t_max);
+            for (int a = 0; a < 3; a++) {
+                float4 t0 = (float4::load(node.bounds[r.sign[a]][a]) - origin[a]) * inv_dir[a];
+                float4 t1 = (float4::load(node.bounds[1 - r.sign[a]][a]) - origin[a]) * inv_dir[a] * far_scale;
+                tmin = vmax(t0, tmin);
+                tmax = vmin(t1, tmax);
+            }
+            int hits = ~(tmax < tmin) & ((1 << node.n_children) - 1);
+            if (hits) {
+                entry found[4];
+                int n = 0;
+                for (int k = 0; k < 4; k++) {
+                    if (hits >> k & 1) {
+                        entry e = { node.child[k], node.n_primitives[k], tmin[k] };
+                        int j = n++;
+                        // insertion sort, nearest first
+                        for (; bvh_ordered_traversal && j > 0 && found[j - 1].t > e.t; j--)
+                            found[j] = found[j - 1];
+                        found[j] = e;
+                    }
+                }
+                for (int k = n - 1; k > 0; k--)
+                    stack[stack_size++] = found[k];
+                current = found[0];
+                continue;
+            }
+        }
+        do {
+            if (stack_size == 0) {
+                bvh_stats.nodes_visited += visited;
+                return hit_anything;
+            }
+            current = stack[--stack_size];
+        } while (current.t > t_max);
+    }
 }
 
+template <typename F>
+void bvh_tree::traverse4(const ray4& r, int active, float t_min, float* t_max, F&& hit_primitives) const {
+    if (node_count == 0 || !active)
+        return;
+    if (bvh_wide && !wide.empty())
+        return traverse4_wide(r, active, t_min, t_max, hit_primitives);
+    const int* dir_is_neg = r.rays[r.lead].sign;
+    struct entry {
+        int node;
+        int lanes;
+    };
+    entry stack[bvh_max_depth];
+    int stack_size = 0;
+    entry current = { 0, active };
+    uint64_t visited = 0;
+    float4 lo(t_min);
+    while (true) {
+        const linear_bvh_node& node = node_data[current.node];
+        visited++;
+        int lanes = current.lanes & slab_hit4(node.bmin, node.bmax, r, lo, float4::load(t_max));
+        if (lanes) {
+            if (node.n_primitives > 0) {
+                for (int i = 0; i < node.n_primitives; i++)
+                    hit_primitives(node.primitives_offset + i, lanes);
+            }
+            else {
+                // near-first for the lead ray; the packet is coherent enough
+                // for that to suit the others too
+                if (bvh_ordered_traversal && dir_is_neg[node.axis]) {
+                    stack[stack_size++] = entry{ current.node + 1, lanes };
+                    current = entry{ node.second_child_offset, lanes };
+                }
+                else {
+                    stack[stack_size++] = entry{ node.second_child_offset, lanes };
+                    current = entry{ current.node + 1, lanes };
+                }
+                continue;
+            }
+        }
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+    bvh_stats.nodes_visited += visited;
+}
 
-bvh_node::bvh_node(hittable** l, int n, float time0, float time1) {
-    int axis = int(3 * random_double());
-    if (axis == 0)
-        qsort(l, n, sizeof(hittable*), box_x_compare);
-    else if (axis == 1)
-        qsort(l, n, sizeof(hittable*), box_y_compare);
-    else
-        qsort(l, n, sizeof(hittable*), box_z_compare);
-    if (n == 1) {
-        left = right = l[0];
+// When the lanes agree on the sign of every direction component, their
+// origins and reciprocal directions span a frustum. One interval slab test
+// of that frustum against all four children of a node, as cheap as a
+// single ray's, culls every child no lane can hit. Only the children that
+// pass get the exact per-lane test, which gives the lanes entering them.
+// Packets that diverge skip the frustum and test each child directly.
+template <typename F>
+void bvh_tree::traverse4_wide(const ray4& r, int active, float t_min, float* t_max, F&& hit_primitives) const {
+    struct entry {
+        int index;
+        int count;      // primitives of a leaf, 0 for a wide node
+        int lanes;
+        float t;        // frustum entry, for ordering only
+    };
+    // Per axis, the origin extremes that give the earliest entry into the
+    // near plane and the latest exit from the far one, and the range of the
+    // reciprocal directions; infinite reciprocals would make NaNs here.
+    const ray& lead = r.rays[r.lead];
+    bool frustum = true;
+    int sign[3];
+    float4 near_origin[3], far_origin[3], inv_lo[3], inv_hi[3];
+    float packet_t_max = 0.0f;
+    for (int i = 0; i < 4; i++)
+        if (active >> i & 1)
+            packet_t_max = ffmax(packet_t_max, t_max[i]);
+    for (int a = 0; a < 3 && frustum; a++) {
+        sign[a] = lead.sign[a];
+        float o_lo = FLT_MAX, o_hi = -FLT_MAX, i_lo = FLT_MAX, i_hi = -FLT_MAX;
+        for (int i = 0; i < 4; i++) {
+            if (!(active >> i & 1))
+                continue;
+            const ray& lane = r.rays[i];
+            if (lane.sign[a] != sign[a] || !(fabsf(lane.inv_dir[a]) <= FLT_MAX))
+                frustum = false;
+            o_lo = ffmin(o_lo, lane.A[a]);
+            o_hi = ffmax(o_hi, lane.A[a]);
+            i_lo = ffmin(i_lo, lane.inv_dir[a]);
+            i_hi = ffmax(i_hi, lane.inv_dir[a]);
+        }
+        near_origin[a] = float4(sign[a] ? o_lo : o_hi);
+        far_origin[a] = float4(sign[a] ? o_hi : o_lo);
+        inv_lo[a] = float4(i_lo);
+        inv_hi[a] = float4(i_hi);
     }
-    else if (n == 2) {
-        left = l[0];
-        right = l[1];
+    const float4 far_scale(slab_far_scale);
+    entry stack[3 * bvh_max_depth + 1];
+    int stack_size = 0;
+    entry current = { 0, 0, active, t_min };
+    uint64_t visited = 0;
+    float4 lo(t_min);
+    while (true) {
+        if (current.count > 0) {
+            for (int i = 0; i < current.count; i++)
+                hit_primitives(current.index + i, current.lanes);
+        }
+        else {
+            const bvh4_node& node = wide[current.index];
+            visited++;
+            int candidates = (1 << node.n_children) - 1;
+            float4 tmin(t_min);
+            if (frustum) {
+                float4 tmax(packet_t_max);
+                for (int a = 0; a < 3; a++) {
+                    float4 d = float4::load(node.bounds[sign[a]][a]) - near_origin[a];
+                    float4 e = float4::load(node.bounds[1 - sign[a]][a]) - far_origin[a];
+                    tmin = vmax(vmin(d * inv_lo[a], d * inv_hi[a]), tmin);
+                    tmax = vmin(vmax(e * inv_lo[a], e * inv_hi[a]) * far_scale, tmax);
+                }
+                candidates &= ~(tmax < tmin);
+            }
+            float4 hi = float4::load(t_max);
+            entry found[4];
+            int n = 0;
+            for (int k = 0; k < 4; k++) {
+                if (!(candidates >> k & 1))
+                    continue;
+                float bmin[3] = { node.bounds[0][0][k], node.bounds[0][1][k], node.bounds[0][2][k] };
+                float bmax[3] = { node.bounds[1][0][k], node.bounds[1][1][k], node.bounds[1][2][k] };
+                float4 t_entry;
+                int lanes = current.lanes & slab_hit4(bmin, bmax, r, lo, hi, &t_entry);
+                if (!lanes)
+                    continue;
+                // without a frustum, rays whose lead missed the box sort it last
+                float t = frustum ? tmin[k] : (lanes >> r.lead & 1) ? t_entry[r.lead] : FLT_MAX;
+                entry e = { node.child[k], node.n_primitives[k], lanes, t };
+                int j = n++;
+                for (; bvh_ordered_traversal && j > 0 && found[j - 1].t > e.t; j--)
+                    found[j] = found[j - 1];
+                found[j] = e;
+            }
+            if (n > 0) {
+                for (int k = n - 1; k > 0; k--)
+                    stack[stack_size++] = found[k];
+                current = found[0];
+                continue;
+            }
+        }
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
     }
-    else {
-        left = new bvh_node(l, n / 2, time0, time1);
-        right = new bvh_node(l + n / 2, n - n / 2, time0, time1);
+    bvh_stats.nodes_visited += visited;
+}
+
+// Scene level BVH over hittables. The primitive pointers are stored in leaf
+// order next to the node array, so traversal never chases per-node pointers.
+// The pointer array goes in the scene's arena after the objects it indexes;
+// the nodes stay in the one vector they were built in, as copying them over
+// would double the peak memory of a large build.
+class linear_bvh : public hittable {
+public:
+    linear_bvh(hittable** l, int n, float time0, float time1, bvh_split method, sampler& rng, arena& memory);
+    // Fits the tree to the primitives over the shutter interval [time0,
+    // time1], e.g. for the next frame of an animation, refitting the BVHs of
+    // objects placed in it first. Returns true if this tree had degraded and
+    // was rebuilt.
+    virtual bool refit(float time0, float time1, sampler& rng);
+    // Refits this tree alone over the interval it was last fit to, e.g.
+    // after instance::set_transform moved some of its primitives; the BVHs
+    // of the objects they place are left alone. Rebuilds it once it has
+    // degraded and returns true if it did.
+    bool update(sampler& rng);
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+    virtual int hit4(const ray4& r, int active, float t_min, float* t_max, hit_record* rec) const;
+    virtual bool bounding_box(float t0, float t1, aabb& b) const {
+        b = bounds;
+        return tree.node_count > 0;
+    }
+
+    bvh_tree tree;
+    hittable** primitives;
+    int count;
+    bvh_split method;
+    aabb bounds;
+    float fit_time0, fit_time1;     // the interval the tree was last fit to
+
+private:
+    void build(float time0, float time1, sampler& rng);
+    bool fit(float time0, float time1, sampler& rng);
+};
+
+linear_bvh::linear_bvh(hittable** l, int n, float time0, float time1, bvh_split method, sampler& rng, arena& memory)
+    : count(n), method(method) {
+    primitives = memory.make_array<hittable*>(n);
+    std::copy(l, l + n, primitives);
+    build(time0, time1, rng);
+}
+
+// (Re)builds the tree over `primitives` and puts them in leaf order.
+void linear_bvh::build(float time0, float time1, sampler& rng) {
+    std::vector<bvh_primitive> prims(count);
+    for (int i = 0; i < count; i++) {
+        if (!primitives[i]->bounding_box(time0, time1, prims[i].box))
+            std::cerr << "no bounding box in linear_bvh::build\n";
+        prims[i].centroid = prims[i].box.centroid();
+        prims[i].index = i;
     }
-    aabb box_left, box_right;
-    if (!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right))
-        std::cerr << "no bounding box in bvh_node constructor\n";
-    box = surrounding_box(box_left, box_right);
+    tree.build(prims, method, rng);
+    std::vector<hittable*> unordered(primitives, primitives + count);
+    for (int i = 0; i < count; i++)
+        primitives[i] = unordered[tree.indices[i]];
+    std::vector<int>().swap(tree.indices);
+    bounds = tree.root_bounds();
+    fit_time0 = time0;
+    fit_time1 = time1;
+}
+
+bool linear_bvh::refit(float time0, float time1, sampler& rng) {
+    // an object placed by many instances is reached once through each
+    if (time0 == fit_time0 && time1 == fit_time1)
+        return false;
+    for (int i = 0; i < count; i++)
+        primitives[i]->refit(time0, time1, rng);
+    return fit(time0, time1, rng);
+}
+
+bool linear_bvh::update(sampler& rng) {
+    return fit(fit_time0, fit_time1, rng);
+}
+
+bool linear_bvh::fit(float time0, float time1, sampler& rng) {
+    fit_time0 = time0;
+    fit_time1 = time1;
+    tree.refit([&](int i, aabb& box) { primitives[i]->bounding_box(time0, time1, box); });
+    bool rebuild = tree.degraded();
+    if (rebuild)
+        build(time0, time1, rng);
+    else
+        bounds = tree.root_bounds();
+    return rebuild;
+}
+
+bool linear_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    return tree.traverse(r, t_min, t_max, [&](int i, float tmin, float& tmax) {
+        if (primitives[i]->hit(r, tmin, tmax, rec)) {
+            tmax = rec.t;
+            return true;
+        }
+        return false;
+    });
+}
+
+int linear_bvh::hit4(const ray4& r, int active, float t_min, float* t_max, hit_record* rec) const {
+    int hits = 0;
+    tree.traverse4(r, active, t_min, t_max, [&](int i, int lanes) {
+        hits |= primitives[i]->hit4(r, lanes, t_min, t_max, rec);
+    });
+    return hits;
+}
+
+linear_bvh* build_bvh(hittable** l, int n, float time0, float time1, sampler& rng, arena& memory) {
+    auto start = std::chrono::high_resolution_clock::now();
+    linear_bvh* root = memory.make<linear_bvh>(l, n, time0, time1, bvh_default_split, rng, memory);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << " - bvh " << (bvh_default_split == bvh_split::sah ? "sah" : "median")
+        << " build " << n << " prims " << ms << " ms"
+        << " (" << (ms > 0 ? n / (ms * 1000.0) : 0.0) << " Mprims/s, "
+        << (bvh_default_split == bvh_split::sah ? bvh_thread_count() : 1) << " threads)"
+        << ", sah cost " << root->tree.sah_cost()
+        << ", " << root->tree.node_count << " nodes"
+        << (root->tree.wide.empty() ? "" : " + " + std::to_string(root->tree.wide.size()) + " bvh4")
+        << " (" << (n > 0 ? float(root->tree.memory_bytes() + root->tree.wide_bytes()) / n : 0.0f) << " bytes/prim)\n";
+    return root;
 }
 
 #endif
\ No newline at end of file
@@ -5,17 +5,17 @@
 #include "ray.h"
 #include "random.h"
 
-vec3 random_in_unit_disk() {
+vec3 random_in_unit_disk(sampler& rng) {
     vec3 p;
     do {
-        p = 2.0 * vec3(random_double(), random_double(), 0) - vec3(1, 1, 0);
+        p = 2.0 * vec3(rng.next_float(), rng.next_float(), 0) - vec3(1, 1, 0);
     } while (dot(p, p) >= 1.0);
     return p;
 }
 
 class camera {
 public:
-    camera(vec3 lookfrom, vec3 lookat, vec3 vup, float vfov, float aspect,
+    camera(const vec3& lookfrom, const vec3& lookat, const vec3& vup, float vfov, float aspect,
         float aperture, float focus_dist, float t0, float t1)
     {
         time0 = t0;
@@ -35,13 +35,13 @@ public:
         horizontal = 2 * half_width * focus_dist * u;
         vertical = 2 * half_height * focus_dist * v;
     }
-    ray get_ray(float s, float t) {
-        vec3 rd = lens_radius * random_in_unit_disk();
+    ray get_ray(float s, float t, sampler& rng) const {
+        vec3 rd = lens_radius * random_in_unit_disk(rng);
         vec3 offset = u * rd.x() + v * rd.y();
-        float time = time0 + (float)random_double() * (time1 - time0);
+        float time = time0 + rng.next_float() * (time1 - time0);
         return ray(origin + offset,
             lower_left_corner + s * horizontal + t * vertical
-            - origin - offset);
+            - origin - offset, time);
     }
 
     vec3 origin;
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef FRAMEBUFFERH
+#define FRAMEBUFFERH
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <vector>
+
+const size_t cache_line_size = 64;
+
+// Preallocated image the render workers write into directly. Tiles never
+// overlap, so no locking is needed. The storage and every row start on a
+// cache line, so tiles whose width is a multiple of
+// cache_line_size / gcd(sizeof(T), cache_line_size) pixels never share a
+// line with their neighbours either.
+template <typename T>
+class framebuffer {
+public:
+    framebuffer(int w, int h) : width(w), height(h) {
+        size_t pixels_per_line = 1;
+        while ((pixels_per_line * sizeof(T)) % cache_line_size != 0)
+            pixels_per_line++;
+        stride = (size_t(w) + pixels_per_line - 1) / pixels_per_line * pixels_per_line;
+        storage.resize(stride * h * sizeof(T) + cache_line_size);
+        uintptr_t base = reinterpret_cast<uintptr_t>(storage.data());
+        uintptr_t aligned = (base + cache_line_size - 1) & ~uintptr_t(cache_line_size - 1);
+        pixels = reinterpret_cast<T*>(aligned);
+        for (size_t i = 0; i < stride * h; i++)
+            new (pixels + i) T();
+    }
+    ~framebuffer() {
+        for (size_t i = 0; i < stride * height; i++)
+            pixels[i].~T();
+    }
+    framebuffer(const framebuffer&) = delete;
+    framebuffer& operator=(const framebuffer&) = delete;
+
+    T& operator()(int x, int y) { return pixels[size_t(y) * stride + x]; }
+    const T& operator()(int x, int y) const { return pixels[size_t(y) * stride + x]; }
+    // row major index y * width + x, bottom row first like the buffer
+    const T& operator[](int index) const { return (*this)(index % width, index / width); }
+
+    int width;
+    int height;
+    size_t stride;
+
+private:
+    std::vector<unsigned char> storage;
+    T* pixels;
+};
+
+#endif
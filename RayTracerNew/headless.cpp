@@ -0,0 +1,237 @@
+// Command line front end for scripted renders: no window and no SFML, so
+// it builds on machines without a display. Human readable progress goes to
+// stderr; stdout gets one JSON line with the timings per frame.
+//
+//   headless --scene cornell_box --width 600 --height 400 --spp 150
+//            --threads 8 --seed 0 --output cornell.png
+
+// SFML's graphics library carries its own copy of stb_image, so only this
+// executable compiles the implementation
+#define STB_IMAGE_IMPLEMENTATION
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "scenes.h"
+#include "renderer.h"
+#include "image_io.h"
+
+void PrintUsage()
+{
+	std::cerr << "usage: headless [options]\n"
+		<< "  --scene NAME      a .scene file, or one of";
+	for (const char* name : sceneNames)
+		std::cerr << " " << name;
+	std::cerr << " (default cornell_box)\n"
+		<< "  --width N         image width (default 600)\n"
+		<< "  --height N        image height (default 400)\n"
+		<< "  --spp N           samples per pixel (default 150)\n"
+		<< "  --adaptive        stop converged pixels early and write NAME_samples.ppm,\n"
+		<< "                    white where a pixel got --max-spp samples\n"
+		<< "  --threshold F     adaptive noise threshold in display units (default 0.03)\n"
+		<< "  --max-spp N       adaptive sample limit per pixel (default 4x spp)\n"
+		<< "  --packets         trace camera rays in 2x2 packets\n"
+		<< "  --binary-bvh      traverse binary BVH nodes instead of four-wide ones\n"
+		<< "  --benchmark       time primary rays through the scene before rendering\n"
+		<< "  --frames N        render N frames, each a shutter interval later (default 1)\n"
+		<< "  --threads N       worker threads, 0 for all cores (default 0)\n"
+		<< "  --build-threads N threads building the BVHs, 0 for all cores (default 0)\n"
+		<< "  --seed N          sample seed (default 0)\n"
+		<< "  --output PATH     .ppm, .pfm or .png (default render.ppm)\n";
+}
+
+image_format FormatFromPath(const std::string& path)
+{
+	std::string extension = path.substr(path.find_last_of('.') + 1);
+	if (extension == "pfm")
+		return image_pfm;
+	if (extension == "png")
+		return image_png;
+	return image_ppm;
+}
+
+// render_0003.png -> render_0003_samples.ppm, always a ppm as it is a plain
+// grey map rather than a picture
+std::string SampleMapPath(const std::string& path)
+{
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return path + "_samples.ppm";
+	return path.substr(0, dot) + "_samples.ppm";
+}
+
+// render.png -> render_0003.png when there is more than one frame
+std::string FramePath(const std::string& path, int frame, int frames)
+{
+	if (frames == 1)
+		return path;
+	char number[16];
+	snprintf(number, sizeof(number), "_%04d", frame);
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return path + number;
+	return path.substr(0, dot) + number + path.substr(dot);
+}
+
+std::string JsonString(const std::string& text)
+{
+	std::string quoted = "\"";
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			quoted += '\\';
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+int main(int argc, char** argv)
+{
+	RenderSettings settings;
+	settings.threads = 0;
+	settings.progressive = false;
+	std::string sceneName = "cornell_box";
+	std::string output = "render.ppm";
+	bool benchmark = false;
+	int frames = 1;
+	int maxSpp = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--adaptive")
+			settings.adaptive.enabled = true;
+		else if (arg == "--threshold" && hasValue)
+			settings.adaptive.threshold = float(std::atof(argv[++i]));
+		else if (arg == "--max-spp" && hasValue)
+			maxSpp = std::atoi(argv[++i]);
+		else if (arg == "--packets")
+			settings.packets = true;
+		else if (arg == "--binary-bvh")
+			bvh_wide = false;
+		else if (arg == "--benchmark")
+			benchmark = true;
+		else if (arg == "--frames" && hasValue)
+			frames = std::atoi(argv[++i]);
+		else if (arg == "--scene" && hasValue)
+			sceneName = argv[++i];
+		else if (arg == "--width" && hasValue)
+			settings.nx = std::atoi(argv[++i]);
+		else if (arg == "--height" && hasValue)
+			settings.ny = std::atoi(argv[++i]);
+		else if (arg == "--spp" && hasValue)
+			settings.ns = std::atoi(argv[++i]);
+		else if (arg == "--threads" && hasValue)
+			settings.threads = std::atoi(argv[++i]);
+		else if (arg == "--build-threads" && hasValue)
+			bvh_build_threads = std::atoi(argv[++i]);
+		else if (arg == "--seed" && hasValue)
+			settings.seed = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--output" && hasValue)
+			output = argv[++i];
+		else
+		{
+			PrintUsage();
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+	settings.adaptive.max_spp = maxSpp > 0 ? maxSpp : 4 * settings.ns;
+
+	if (settings.nx <= 0 || settings.ny <= 0 || settings.ns <= 0 || settings.threads < 0 || bvh_build_threads < 0 || frames <= 0
+		|| maxSpp < 0 || !(settings.adaptive.threshold > 0.0f))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// scene construction and the render core log to std::cout; send that to
+	// stderr so stdout only carries the result line
+	std::streambuf* stdoutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+	std::ostream result(stdoutBuffer);
+
+	auto sceneStart = std::chrono::high_resolution_clock::now();
+	sampler sceneRng(settings.seed);
+	scene world;
+	scene_view view;
+	if (!load_scene(ScenePath(sceneName), sceneRng, world, view))
+		return 1;
+	double sceneMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sceneStart).count();
+
+	image_writer writer;
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		// each frame's shutter opens where the previous one closed; the BVH
+		// built for the first is refit to follow what moves
+		scene_view frameView = view;
+		float shift = frame * (view.time1 - view.time0);
+		frameView.time0 += shift;
+		frameView.time1 += shift;
+		double refitMs = 0.0;
+		bool rebuilt = false;
+		if (frame > 0)
+		{
+			auto refitStart = std::chrono::high_resolution_clock::now();
+			rebuilt = world.bvh->refit(frameView.time0, frameView.time1, sceneRng);
+			refitMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - refitStart).count();
+			std::cerr << " - frame " << frame << ": bvh " << (rebuilt ? "rebuilt" : "refit") << " in " << refitMs
+				<< " ms, sah cost " << world.bvh->tree.sah_cost() << " (" << world.bvh->tree.sah_cost() / world.bvh->tree.build_cost
+				<< "x the build's)\n";
+		}
+
+		camera cam = frameView.make_camera(settings.nx, settings.ny);
+		if (benchmark && frame == 0)
+			TraversalBenchmark(sceneName, world.world, cam, settings.nx, settings.ny);
+
+		Renderer renderer(settings, world, cam);
+		renderer.Render();
+		renderer.PrintStats(std::cerr);
+
+		// the writer thread saves this frame while the next one renders, so
+		// write_ms only covers the final frame's wait
+		std::string framePath = FramePath(output, frame, frames);
+		auto writeStart = std::chrono::high_resolution_clock::now();
+		writer.submit(renderer.Snapshot(), framePath, FormatFromPath(framePath));
+		std::string samplesPath = SampleMapPath(framePath);
+		if (settings.adaptive.enabled)
+			writer.submit(renderer.SampleMap(), samplesPath, image_ppm, image_tonemap::linear);
+		if (frame == frames - 1)
+			writer.finish();
+		double writeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - writeStart).count();
+
+		path_counters paths = renderer.PathCounters();
+		long long samples = renderer.TotalSamples();
+		double renderMs = renderer.renderSeconds * 1000.0;
+		result << "{\"scene\":" << JsonString(sceneName);
+		if (frames > 1)
+			result << ",\"frame\":" << frame << ",\"time\":" << frameView.time0;
+		if (frame > 0)
+			result << ",\"bvh_update\":" << (rebuilt ? "\"rebuild\"" : "\"refit\"") << ",\"bvh_update_ms\":" << refitMs;
+		result << ",\"width\":" << settings.nx
+			<< ",\"height\":" << settings.ny
+			<< ",\"spp\":" << settings.ns
+			<< ",\"adaptive\":" << (settings.adaptive.enabled ? "true" : "false");
+		if (settings.adaptive.enabled)
+			result << ",\"threshold\":" << settings.adaptive.threshold << ",\"max_spp\":" << settings.adaptive.max_spp;
+		result << ",\"packets\":" << (settings.packets ? "true" : "false")
+			<< ",\"bvh\":" << (bvh_wide ? "\"bvh4\"" : "\"binary\"")
+			<< ",\"threads\":" << renderer.scheduler.workers
+			<< ",\"seed\":" << settings.seed
+			<< ",\"scene_ms\":" << sceneMs
+			<< ",\"scene_bytes\":" << world.memory_bytes
+			<< ",\"render_ms\":" << renderMs
+			<< ",\"write_ms\":" << writeMs
+			<< ",\"passes\":" << renderer.passes
+			<< ",\"samples\":" << samples
+			<< ",\"paths\":" << paths.paths
+			<< ",\"segments\":" << paths.segments
+			<< ",\"msamples_per_s\":" << (renderMs > 0 ? double(samples) / (renderMs * 1000.0) : 0.0)
+			<< ",\"output\":" << JsonString(framePath);
+		if (settings.adaptive.enabled)
+			result << ",\"sample_map\":" << JsonString(samplesPath);
+		result << "}" << std::endl;
+	}
+	std::cout.rdbuf(stdoutBuffer);
+	return 0;
+}
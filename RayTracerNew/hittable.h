@@ -2,7 +2,9 @@
 #ifndef HITABLEH
 #define HITABLEH
 
+#include <cfloat>
 #include "aabb.h"
+#include "random.h"
 
 class material;
 
@@ -28,8 +30,34 @@ public:
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
     virtual bool bounding_box(float t0, float t1, aabb& box) const = 0;
 
+    // Tests the `active` lanes of a packet. t_max[i] is lane i's closest hit
+    // so far and shrinks with every new one, whose record goes to rec[i].
+    // Returns the lanes that hit. By default the rays go one at a time.
+    virtual int hit4(const ray4& r, int active, float t_min, float* t_max, hit_record* rec) const;
+
+    // Fits any BVH inside to the shutter interval [time0, time1]; returns
+    // true if one had degraded and was rebuilt. Plain geometry has none.
+    virtual bool refit(float time0, float time1, sampler& rng) { return false; }
+
+    // Light sampling for next-event estimation, only meaningful for emitters.
+    // random() returns a (not normalised) direction from o to a point on the
+    // surface and pdf_value() the solid angle density of direction v from o.
+    virtual bool is_light() const { return false; }
+    virtual float pdf_value(const vec3& o, const vec3& v) const { return 0.0f; }
+    virtual vec3 random(const vec3& o, sampler& rng) const { return vec3(1, 0, 0); }
 };
 
+int hittable::hit4(const ray4& r, int active, float t_min, float* t_max, hit_record* rec) const {
+    int hits = 0;
+    for (int i = 0; i < 4; i++) {
+        if ((active >> i & 1) && hit(r.rays[i], t_min, t_max[i], rec[i])) {
+            t_max[i] = rec[i].t;
+            hits |= 1 << i;
+        }
+    }
+    return hits;
+}
+
 class flip_normals : public hittable {
 public:
     flip_normals(hittable* p) : ptr(p) {}
@@ -44,6 +72,9 @@ public:
     virtual bool bounding_box(float t0, float t1, aabb& box) const {
         return ptr->bounding_box(t0, t1, box);
     }
+    virtual bool is_light() const { return ptr->is_light(); }
+    virtual float pdf_value(const vec3& o, const vec3& v) const { return ptr->pdf_value(o, v); }
+    virtual vec3 random(const vec3& o, sampler& rng) const { return ptr->random(o, rng); }
     hittable* ptr;
 };
 
@@ -57,7 +88,7 @@ public:
 };
 
 bool translate::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-    ray moved_r(r.origin() - offset, r.direction(), r.time());
+    ray moved_r = r.moved(r.origin() - offset);
     if (ptr->hit(moved_r, t_min, t_max, rec)) {
         rec.p += offset;
         return true;
@@ -0,0 +1,255 @@
+#pragma once
+#ifndef IMAGEIOH
+#define IMAGEIOH
+
+#include <stdint.h>
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum image_format {
+    image_ppm = 1,      // binary P6, 8 bits a channel
+    image_pfm = 2,      // linear 32 bit floats, for HDR tools
+    image_png = 4,      // 16 bits a channel
+};
+
+enum class image_tonemap {
+    gamma2,             // sqrt, as the preview shows it
+    linear,
+};
+
+// Linear RGB floats in display order (top row first), three per pixel.
+struct image {
+    image(int w, int h) : width(w), height(h), rgb(size_t(w) * h * 3) {}
+    float* pixel(int index) { return &rgb[size_t(index) * 3]; }
+    const float* row(int y) const { return &rgb[size_t(y) * width * 3]; }
+
+    int width;
+    int height;
+    std::vector<float> rgb;
+};
+
+// Tonemap, clamp and quantize count channel values in one pass. There are
+// no branches on the data, so the loop vectorises; negatives and NaN end up 0.
+template <typename T>
+inline void quantize(const float* in, T* out, size_t count, image_tonemap tonemap, float scale) {
+    if (tonemap == image_tonemap::gamma2) {
+        for (size_t k = 0; k < count; k++) {
+            float c = in[k] > 0 ? in[k] : 0.0f;
+            c = std::sqrt(c);
+            out[k] = T((c < 1 ? c : 1.0f) * scale);
+        }
+    }
+    else {
+        for (size_t k = 0; k < count; k++) {
+            float c = in[k] > 0 ? in[k] : 0.0f;
+            out[k] = T((c < 1 ? c : 1.0f) * scale);
+        }
+    }
+}
+
+inline bool write_ppm(const image& img, const std::string& path, image_tonemap tonemap) {
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    if (!file.is_open())
+        return false;
+    std::vector<unsigned char> bytes(img.rgb.size());
+    quantize(img.rgb.data(), bytes.data(), bytes.size(), tonemap, 255.99f);
+    file << "P6\n" << img.width << " " << img.height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    return bool(file);
+}
+
+// PFM stores the bottom row first; a negative scale marks little endian data.
+inline bool write_pfm(const image& img, const std::string& path) {
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    if (!file.is_open())
+        return false;
+    const uint16_t one = 1;
+    bool little_endian = *reinterpret_cast<const unsigned char*>(&one) == 1;
+    file << "PF\n" << img.width << " " << img.height << "\n" << (little_endian ? "-1.0" : "1.0") << "\n";
+    for (int y = img.height - 1; y >= 0; y--)
+        file.write(reinterpret_cast<const char*>(img.row(y)), sizeof(float) * 3 * img.width);
+    return bool(file);
+}
+
+namespace png_detail {
+
+inline uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size) {
+    struct crc_table {
+        uint32_t entries[256];
+        crc_table() {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                entries[n] = c;
+            }
+        }
+    };
+    static const crc_table table;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline void put32(std::vector<unsigned char>& out, uint32_t v) {
+    out.push_back(v >> 24);
+    out.push_back((v >> 16) & 0xff);
+    out.push_back((v >> 8) & 0xff);
+    out.push_back(v & 0xff);
+}
+
+inline void chunk(std::ofstream& file, const char* type, const std::vector<unsigned char>& data) {
+    std::vector<unsigned char> head;
+    put32(head, uint32_t(data.size()));
+    head.insert(head.end(), type, type + 4);
+    uint32_t crc = crc32(0, head.data() + 4, 4);
+    crc = crc32(crc, data.data(), data.size());
+    std::vector<unsigned char> tail;
+    put32(tail, crc);
+    file.write(reinterpret_cast<const char*>(head.data()), head.size());
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    file.write(reinterpret_cast<const char*>(tail.data()), tail.size());
+}
+
+}
+
+// 16 bit RGB PNG. The bundled stb only reads images, so this writes the
+// zlib stream as stored (uncompressed) deflate blocks: larger than a real
+// encoder's output, but written at memcpy speed and readable everywhere.
+inline bool write_png(const image& img, const std::string& path, image_tonemap tonemap) {
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    if (!file.is_open())
+        return false;
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    file.write(reinterpret_cast<const char*>(signature), 8);
+
+    std::vector<unsigned char> header;
+    png_detail::put32(header, img.width);
+    png_detail::put32(header, img.height);
+    const unsigned char format[5] = { 16, 2, 0, 0, 0 };    // depth, RGB, deflate, no filter, no interlace
+    header.insert(header.end(), format, format + 5);
+    png_detail::chunk(file, "IHDR", header);
+
+    // scanlines: filter type 0, then big endian 16 bit samples
+    size_t line = 1 + size_t(img.width) * 6;
+    std::vector<unsigned char> raw(line * img.height);
+    std::vector<uint16_t> samples(size_t(img.width) * 3);
+    for (int y = 0; y < img.height; y++) {
+        unsigned char* out = &raw[line * y];
+        out[0] = 0;
+        quantize(img.row(y), samples.data(), samples.size(), tonemap, 65535.99f);
+        for (size_t k = 0; k < samples.size(); k++) {
+            out[1 + 2 * k] = samples[k] >> 8;
+            out[2 + 2 * k] = samples[k] & 0xff;
+        }
+    }
+
+    std::vector<unsigned char> zlib;
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    uint32_t a = 1, b = 0;
+    size_t pos = 0;
+    do {
+        size_t len = raw.size() - pos < 65535 ? raw.size() - pos : 65535;
+        zlib.push_back(pos + len == raw.size() ? 1 : 0);
+        zlib.push_back(len & 0xff);
+        zlib.push_back(len >> 8);
+        zlib.push_back(~len & 0xff);
+        zlib.push_back((~len >> 8) & 0xff);
+        zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + len);
+        // adler32, reduced every 5552 bytes: the most that cannot overflow
+        for (size_t i = pos; i < pos + len; ) {
+            size_t end = pos + len - i < 5552 ? pos + len : i + 5552;
+            for (; i < end; i++) {
+                a += raw[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        pos += len;
+    } while (pos < raw.size());
+    png_detail::put32(zlib, (b << 16) | a);
+    png_detail::chunk(file, "IDAT", zlib);
+    png_detail::chunk(file, "IEND", std::vector<unsigned char>());
+    return bool(file);
+}
+
+// Writes finished images on a thread of its own so the caller can go on
+// (start the next frame, keep the window responsive) while they hit the
+// disk. Images are shared, so one snapshot can go out in several formats.
+class image_writer {
+public:
+    image_writer() : done(false), worker([this]() { run(); }) {}
+    ~image_writer() { finish(); }
+    image_writer(const image_writer&) = delete;
+    image_writer& operator=(const image_writer&) = delete;
+
+    void submit(std::shared_ptr<const image> img, const std::string& path, image_format format,
+                image_tonemap tonemap = image_tonemap::gamma2) {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job{ img, path, format, tonemap });
+        ready.notify_one();
+    }
+
+    // writes everything still queued, then stops the thread
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+            ready.notify_one();
+        }
+        if (worker.joinable())
+            worker.join();
+    }
+
+private:
+    struct job {
+        std::shared_ptr<const image> img;
+        std::string path;
+        image_format format;
+        image_tonemap tonemap;
+    };
+
+    void run() {
+        for (;;) {
+            job next;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this]() { return done || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                next = jobs.front();
+                jobs.pop_front();
+            }
+            auto start = std::chrono::high_resolution_clock::now();
+            bool ok = next.format == image_pfm ? write_pfm(*next.img, next.path)
+                : next.format == image_png ? write_png(*next.img, next.path, next.tonemap)
+                : write_ppm(*next.img, next.path, next.tonemap);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            if (ok)
+                std::cout << " - saved " << next.path << " (" << ms << " ms)\n";
+            else
+                std::cerr << "could not write " << next.path << "\n";
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<job> jobs;
+    bool done;
+    std::thread worker;     // last, so it starts after the rest is set up
+};
+
+#endif
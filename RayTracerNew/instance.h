@@ -0,0 +1,95 @@
+#pragma once
+#ifndef INSTANCEH
+#define INSTANCEH
+
+#include "hittable.h"
+#include "material.h"
+#include "transform.h"
+
+// One placement of shared geometry (a bottom level structure such as a
+// Model with its own BVH). Rays are taken into object space instead of the
+// geometry being copied, so any number of instances share one mesh.
+class instance : public hittable {
+public:
+    instance() {}
+    instance(hittable* geometry, const affine3& object_to_world, material* override_mat = nullptr);
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+    virtual int hit4(const ray4& r, int active, float t_min, float* t_max, hit_record* rec) const;
+    virtual bool bounding_box(float t0, float t1, aabb& box) const;
+    virtual bool refit(float time0, float time1, sampler& rng) { return ptr->refit(time0, time1, rng); }
+    // Moves the placement. Only the BVH holding the instance has to follow,
+    // with linear_bvh::update; the geometry and its own BVH stay as they are.
+    void set_transform(const affine3& object_to_world);
+    // Light sampling happens in object space. The linear part A of to_world
+    // stretches the solid angle around a unit direction w by
+    // |det A| |A^-1 w|^3, which is 1 for rotations and uniform scales and
+    // corrects the pdf for anything else.
+    virtual bool is_light() const { return mat_ptr ? mat_ptr->is_emissive() : ptr->is_light(); }
+    virtual float pdf_value(const vec3& o, const vec3& v) const {
+        vec3 local = to_object.vector(v / v.length());
+        float stretch = local.length();
+        return ptr->pdf_value(to_object.point(o), local) / (volume_scale * stretch * stretch * stretch);
+    }
+    virtual vec3 random(const vec3& o, sampler& rng) const {
+        return to_world.vector(ptr->random(to_object.point(o), rng));
+    }
+
+    hittable* ptr;
+    material* mat_ptr;
+    affine3 to_world;
+    affine3 to_object;
+    float volume_scale;     // |det| of to_world's linear part
+};
+
+instance::instance(hittable* geometry, const affine3& object_to_world, material* override_mat)
+    : ptr(geometry), mat_ptr(override_mat) {
+    set_transform(object_to_world);
+}
+
+void instance::set_transform(const affine3& object_to_world) {
+    to_world = object_to_world;
+    to_object = object_to_world.inverse();
+    volume_scale = fabsf(object_to_world.determinant());
+}
+
+// Transformed on every call, so the box follows the geometry over [t0, t1]
+// and after a refit of its BVH.
+bool instance::bounding_box(float t0, float t1, aabb& box) const {
+    aabb local;
+    if (!ptr->bounding_box(t0, t1, local))
+        return false;
+    box = to_world.transform_box(local);
+    return true;
+}
+
+bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    // the direction is not renormalised, so t means the same in both spaces
+    ray local(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+    if (!ptr->hit(local, t_min, t_max, rec))
+        return false;
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = unit_vector(to_object.transpose_vector(rec.normal));
+    if (mat_ptr)
+        rec.mat_ptr = mat_ptr;
+    return true;
+}
+
+// The whole packet goes into object space, so a mesh behind an instance
+// still sees it as a packet.
+int instance::hit4(const ray4& r, int active, float t_min, float* t_max, hit_record* rec) const {
+    ray local[4];
+    for (int i = 0; i < 4; i++)
+        local[i] = ray(to_object.point(r.rays[i].origin()), to_object.vector(r.rays[i].direction()), r.rays[i].time());
+    int hits = ptr->hit4(ray4(local, active), active, t_min, t_max, rec);
+    for (int i = 0; i < 4; i++) {
+        if (hits >> i & 1) {
+            rec[i].p = r.rays[i].point_at_parameter(rec[i].t);
+            rec[i].normal = unit_vector(to_object.transpose_vector(rec[i].normal));
+            if (mat_ptr)
+                rec[i].mat_ptr = mat_ptr;
+        }
+    }
+    return hits;
+}
+
+#endif
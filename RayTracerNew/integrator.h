@@ -0,0 +1,117 @@
+#pragma once
+#ifndef INTEGRATORH
+#define INTEGRATORH
+
+#include "hittable.h"
+#include "material.h"
+#include "random.h"
+#include "scene.h"
+
+struct integrator_settings {
+    int max_depth = 50;          // scatter events before a path is cut off
+    int rr_min_depth = 3;        // bounces that always survive Russian roulette
+    bool russian_roulette = true;
+    bool sample_lights = true;   // next-event estimation at non-specular hits
+    bool mis = true;             // weight light and bsdf samples with the power heuristic
+};
+
+// Per tile counts, summed by the caller to report the average path length.
+struct path_counters {
+    uint64_t paths = 0;
+    uint64_t segments = 0;
+};
+
+// The first hit of a camera ray, when it was found as part of a packet.
+struct primary_hit {
+    bool found;
+    hit_record rec;
+};
+
+inline float power_heuristic(float pdf_a, float pdf_b) {
+    float a = pdf_a * pdf_a;
+    float b = pdf_b * pdf_b;
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+// Light reaching a non-specular hit straight from one sampled emitter. With
+// MIS the sample is weighted against the chance the bsdf would have picked
+// the same direction; without it the light sample takes all the weight.
+vec3 direct_light(const scene& world, const ray& r_in, const hit_record& rec, bool mis, sampler& rng) {
+    // normalised so the shadow ray's t_min is a distance, not a fraction of it
+    vec3 to_light = unit_vector(world.lights.random(rec.p, rng));
+    float light_pdf = world.lights.pdf_value(rec.p, to_light);
+    if (light_pdf <= 0)
+        return vec3(0, 0, 0);
+    vec3 f = rec.mat_ptr->eval(r_in, rec, to_light);
+    if (f.squared_length() <= 0)
+        return vec3(0, 0, 0);
+    hit_record light_rec;
+    if (!world.world->hit(ray(rec.p, to_light, r_in.time()), 0.001, FLT_MAX, light_rec))
+        return vec3(0, 0, 0);
+    vec3 emitted = light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p);
+    float weight = mis ? power_heuristic(light_pdf, rec.mat_ptr->pdf(r_in, rec, to_light)) : 1.0f;
+    return f * emitted * (weight / light_pdf);
+}
+
+// Follows one camera path with a running throughput instead of recursing.
+// Past rr_min_depth a path survives with probability equal to its brightest
+// throughput channel (capped at 0.95) and is reweighted when it does, so
+// dim paths end early without biasing the estimate.
+//
+// With sample_lights every non-specular hit also samples the light list.
+// Emission found by the following bsdf bounce is then weighted by the power
+// heuristic (or dropped without MIS) so nothing is counted twice. Bounces
+// off specular surfaces and emitters the list cannot sample keep full weight.
+//
+// A primary hit already found for r_in (see CalculateColorPackets) is used
+// instead of tracing r_in again.
+vec3 trace_path(const ray& r_in, const scene& world, const integrator_settings& settings, sampler& rng, path_counters& counters,
+                const primary_hit* primary = nullptr) {
+    ray r = r_in;
+    vec3 radiance(0, 0, 0);
+    vec3 throughput(1, 1, 1);
+    bool lit_directly = false;
+    float bsdf_pdf = 0;
+    hit_record rec;
+    counters.paths++;
+    for (int depth = 0; ; depth++) {
+        counters.segments++;
+        if (depth == 0 && primary) {
+            if (!primary->found)
+                break;
+            rec = primary->rec;
+        }
+        else if (!world.world->hit(r, 0.001, FLT_MAX, rec))
+            break;
+        if (rec.mat_ptr->is_emissive()) {
+            float weight = 1;
+            if (lit_directly) {
+                float light_pdf = world.lights.pdf_value(r.origin(), unit_vector(r.direction()));
+                if (light_pdf > 0)
+                    weight = settings.mis ? power_heuristic(bsdf_pdf, light_pdf) : 0;
+            }
+            radiance += throughput * rec.mat_ptr->emitted(rec.u, rec.v, rec.p) * weight;
+        }
+
+        lit_directly = settings.sample_lights && !world.lights.empty() && !rec.mat_ptr->is_specular(rec);
+        if (lit_directly)
+            radiance += throughput * direct_light(world, r, rec, settings.mis, rng);
+
+        bsdf_sample s;
+        if (depth >= settings.max_depth || !rec.mat_ptr->sample(r, rec, rng, s))
+            break;
+        throughput *= s.weight;
+        bsdf_pdf = s.pdf;
+        r = s.scattered;
+
+        if (settings.russian_roulette && depth + 1 >= settings.rr_min_depth) {
+            float survive = ffmin(0.95f, ffmax(throughput.x(), ffmax(throughput.y(), throughput.z())));
+            if (rng.next_float() >= survive)
+                break;
+            throughput /= survive;
+        }
+    }
+    return radiance;
+}
+
+#endif
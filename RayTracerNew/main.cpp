@@ -1,16 +1,9 @@
 #include <SFML/Graphics.hpp>
 #include <iostream>
 #include <fstream>
-#include "sphere.h"
-#include "hittablelist.h"
-#include "moving_sphere.h"
-#include "rectangle.h"
-#include "camera.h"
-#include "box.h"
-#include "material.h"
-#include "bvh.h"
-#include "stb_image.h"
-#include "Model.h"
+#include "scenes.h"
+#include "renderer.h"
+#include "image_io.h"
 
 #include <thread>
 #include <vector>
@@ -37,316 +30,102 @@
 //	}
 //}
 
-vec3 color(const ray& r, hittable* world, int depth) {
-	hit_record rec;
-	if (world->hit(r, 0.001, FLT_MAX, rec)) {
-		ray scattered;
-		vec3 attenuation;
-		vec3 emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-		if (depth < 50 && rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-			return emitted + attenuation * color(scattered, world, depth + 1);
-		else
-			return emitted;
-	}
-	else
-		return vec3(0, 0, 0);
-}
-
-hittable* earth() {
-	int nx, ny, nn;
-
-	hittable** list = new hittable * [5];
-	Model* models[5];
-
-	unsigned char* tex_data = stbi_load("models/Doge_Texture.jpg", &nx, &ny, &nn, 0);
-	material* mat = new lambertian(new image_texture(tex_data, nx, ny));
-	material* mat2 = new lambertian(new constant_texture(vec3(0, 0, 0)));
-
-	models[0] = new Model("models/", "dege.obj", mat);
-	models[1] = new Model("models/", "nose.obj", mat2);
-
-	texture* checker = new checker_texture(new constant_texture(vec3(0.2, 0.3, 0.1)), new constant_texture(vec3(0.9, 0.9, 0.9)));
-
-	//list[0] = new sphere(vec3(0, 0, 0), 2, mat);
-	//list[0] = models[0];
-	list[0] = new translate(
-		new rotate_y(new Model("models/", "dege.obj", mat), 0),
-		vec3(0, 0, -1));
-	list[1] = new sphere(vec3(0, -1000, 0), 1000, new lambertian(checker));
-	list[2] = models[1];
-	list[3] = new sphere(vec3(-5, 7, 0), 2,
-		new diffuse_light(new constant_texture(vec3(4, 4, 4))));
-	list[4] = new xy_rect(3, 5, 1, 3, 2,
-		new diffuse_light(new constant_texture(vec3(4, 4, 4))));
-
-	//list[0] = new Model("models/", "cube.obj", new lambertian(new constant_texture(vec3(0.4, 0.2, 0.1))));
-
-	return new bvh_node(list, 5, 0, 1);
-}
-
-hittable* two_spheres() {
-	texture* checker = new checker_texture(
-		new constant_texture(vec3(0.2, 0.3, 0.1)),
-		new constant_texture(vec3(0.9, 0.9, 0.9))
-	);
-	int n = 50;
-	hittable** list = new hittable * [n + 1];
-	list[0] = new sphere(vec3(0, -10, 0), 10, new lambertian(checker));
-	list[1] = new sphere(vec3(0, 10, 0), 10, new lambertian(checker));
-	return new bvh_node(list, 2, 0, 1);
-}
-
-hittable* random_scene() {
-	int n = 50000;
-	hittable** list = new hittable * [n + 1];
-	texture* checker = new checker_texture(new constant_texture(vec3(0.2, 0.3, 0.1)), new constant_texture(vec3(0.9, 0.9, 0.9)));
-	list[0] = new sphere(vec3(0, -1000, 0), 1000, new lambertian(checker));
-	int i = 1;
-	for (int a = -10; a < 10; a++) {
-		for (int b = -10; b < 10; b++) {
-			float choose_mat = random_double();
-			vec3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-			if ((center - vec3(4, 0.2, 0)).length() > 0.9) {
-				if (choose_mat < 0.8) {  // diffuse
-					list[i++] = new moving_sphere(center, center + vec3(0, 0.5 * random_double(), 0), 0.0, 1.0, 0.2, new lambertian(new constant_texture(vec3(random_double() * random_double(), random_double() * random_double(), random_double() * random_double()))));
-				}
-				else if (choose_mat < 0.95) { // metal
-					list[i++] = new sphere(center, 0.2,
-						new metal(vec3(0.5 * (1 + random_double()), 0.5 * (1 + random_double()), 0.5 * (1 + random_double())), 0.5 * random_double()));
-				}
-				else {  // glass
-					list[i++] = new sphere(center, 0.2, new dielectric(1.5));
-				}
-			}
-		}
-	}
-
-	list[i++] = new sphere(vec3(0, 1, 0), 1.0, new dielectric(1.5));
-	list[i++] = new sphere(vec3(-4, 1, 0), 1.0, new lambertian(new constant_texture(vec3(0.4, 0.2, 0.1))));
-	list[i++] = new sphere(vec3(4, 1, 0), 1.0, new metal(vec3(0.7, 0.6, 0.5), 0.0));
-
-	//return new hittable_list(list,i);
-	return new bvh_node(list, i, 0.0, 1.0);
-}
-
-hittable* cornell_box() {
-	hittable** list = new hittable * [8];
-	int i = 0;
-	material* red = new lambertian(new constant_texture(vec3(0.65, 0.05, 0.05)));
-	material* white = new lambertian(new constant_texture(vec3(0.73, 0.73, 0.73)));
-	material* green = new lambertian(new constant_texture(vec3(0.12, 0.45, 0.15)));
-	material* light = new diffuse_light(new constant_texture(vec3(15, 15, 15)));
-
-	list[i++] = new flip_normals(new yz_rect(0, 555, 0, 555, 555, green));
-	list[i++] = new yz_rect(0, 555, 0, 555, 0, red);
-	list[i++] = new xz_rect(213, 343, 227, 332, 554, light);
-	list[i++] = new flip_normals(new xz_rect(0, 555, 0, 555, 555, white));
-	list[i++] = new xz_rect(0, 555, 0, 555, 0, white);
-	list[i++] = new flip_normals(new xy_rect(0, 555, 0, 555, 555, white));
-
-	list[i++] = new translate(
-		new rotate_y(new box(vec3(0, 0, 0), vec3(165, 165, 165), white), -18),
-		vec3(130, 0, 65));
-	list[i++] = new translate(
-		new rotate_y(new box(vec3(0, 0, 0), vec3(165, 330, 165), white), 15),
-		vec3(265, 0, 295));
-
-	return new bvh_node(list, i,0 ,1);
-}
-
-struct BlockJob
-{
-	int rowStart;
-	int rowEnd;
-	int colSize;
-	int spp;
-	std::vector<int> indices;
-	std::vector<vec3> colors;
-};
-
-void CalculateColor(BlockJob job, std::vector<BlockJob>& imageBlocks, int ny, camera cam, hittable* world,
-	std::mutex& mutex, std::condition_variable& cv, std::atomic<int>& completedThreads)
-{
-	for (int j = job.rowStart; j < job.rowEnd; ++j) {
-		for (int i = 0; i < job.colSize; ++i) {
-			vec3 col(0, 0, 0);
-			for (int s = 0; s < job.spp; ++s) {
-				float u = float(i + random_double()) / float(job.colSize);
-				float v = float(j + random_double()) / float(ny);
-				ray r = cam.get_ray(u, v);
-				col += color(r, world, 0);
-			}
-			col /= float(job.spp);
-			col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
-
-			const unsigned int index = j * job.colSize + i;
-			job.indices.push_back(index);
-			job.colors.push_back(col);
-		}
-	}
-	{
-		std::lock_guard<std::mutex> lock(mutex);
-		imageBlocks.push_back(job);
-		completedThreads++;
-		cv.notify_one();
-	}
-}
-bool reverse = true;
-
-void GetReverse(std::vector<int> &ir, std::vector<int>& ig, std::vector<int>& ib)
-{
-	std::reverse(ir.begin(), ir.end());
-	std::reverse(ig.begin(), ig.end());
-	std::reverse(ib.begin(), ib.end());
-
-	reverse = false;
-}
-
 int main() 
 {
-
-	float fov = 40.0f;
-	//std::ofstream my_Image("image.ppm");
-	int nx = 600;
-	int ny = 400;
-	int ns = 150;
-	int pixelCount = nx * ny;
-	hittable* world = cornell_box();
-
-	//vec3 lookfrom(-10, 10, 20);
-	//vec3 lookat(0, 0, -1); //original is (0, 0, -1);
-	vec3 lookfrom(278, 278, -800);
-	vec3 lookat(278, 278, 0);
-	float dist_to_focus = 10.0f;
-	float aperture = 0.0f;
-
-	vec3* image = new vec3[pixelCount];
-	memset(&image[0], 0, pixelCount * sizeof(vec3));
-
-	camera cam(lookfrom, lookat, vec3(0, 1, 0), fov,
-		float(nx) / float(ny), aperture, dist_to_focus, 0.0f, 1.0f);
-
-
-	//camera cam(lookfrom, lookat, vec3(0, 1, 0), fov,
-	//	float(nx) / float(ny), aperture, dist_to_focus, 0.0f, 1.0f);
-
-
-	auto fulltime = std::chrono::high_resolution_clock::now();
-
-	const int nThreads = std::thread::hardware_concurrency();
-	int rowsPerThread = ny / nThreads;
-	int leftOver = ny % nThreads;
-
-	std::mutex mutex;
-	std::condition_variable cvResults;
-	std::vector<BlockJob> imageBlocks;
-	std::atomic<int> completedThreads = { 0 };
-	std::vector<std::thread> threads;
-
-	for (int i = 0; i < nThreads; ++i)
-	{
-		BlockJob job;
-		job.rowStart = i * rowsPerThread;
-		job.rowEnd = job.rowStart + rowsPerThread;
-		if (i == nThreads - 1)
-		{
-			job.rowEnd = job.rowStart + rowsPerThread + leftOver;
-		}
-		job.colSize = nx;
-		job.spp = ns;
-
-		std::thread t([job, &imageBlocks, ny, &cam, &world, &mutex, &cvResults, &completedThreads]() {
-			CalculateColor(job, imageBlocks, ny, cam, world, mutex, cvResults, completedThreads);
-			});
-		threads.push_back(std::move(t));
-	}
-
-	// launched jobs. need to build image.
-	// wait for number of jobs = pixel count
-	{
-		std::unique_lock<std::mutex> lock(mutex);
-		cvResults.wait(lock, [&completedThreads, &nThreads] {
-			return completedThreads == nThreads;
-			});
-	}
-
-	for (std::thread& t : threads)
-	{
-		t.join();
-	}
-
-	for (BlockJob job : imageBlocks)
-	{
-		int index = job.rowStart;
-		int colorIndex = 0;
-		for (vec3& col : job.colors)
-		{
-			int colIndex = job.indices[colorIndex];
-			image[colIndex] = col;
-			++colorIndex;
-		}
-	}
-
-	auto timeSpan = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::high_resolution_clock::now() - fulltime);
-	int frameTimeMs = static_cast<int>(timeSpan.count());
-	std::cout << " - time " << frameTimeMs << " ms \n";
-
-
-	std::string filename =
-		"block-x" + std::to_string(nx)
-		+ "-y" + std::to_string(ny)
-		+ "-s" + std::to_string(ns)
-		+ "-" + std::to_string(frameTimeMs) + "sec.ppm";
-
-	std::ofstream fileHandler;
-	fileHandler.open(filename, std::ios::out | std::ios::binary);
-	if (!fileHandler.is_open())
-	{
-		return false;
-	}
-
-	std::vector<int> ir;
-	std::vector<int> ig;
-	std::vector<int> ib;
-
-	fileHandler << "P3\n" << nx << " " << ny << "\n255\n";
-	for (unsigned int i = 0; i < nx * ny; ++i)
-	{
-		// BGR to RGB Changing hue gives slightly 
-		// 2 = r;
-		// 1 = g;
-		// 0 = b;
-		ir.push_back(static_cast < int>(255.99f * image[i].e[0]));
-		ig.push_back(static_cast < int>(255.99f * image[i].e[1]));
-		ib.push_back(static_cast < int>(255.99f * image[i].e[2]));
-
-	}
-	if (reverse)
-	{
-		GetReverse(ir, ig, ib);
-	}
-
-	for (unsigned int i = 0; i < nx * ny; ++i)
+	// the viewer renders one fixed setup; scripted renders go through headless.cpp
+	RenderSettings settings;
+	settings.nx = 600;
+	settings.ny = 400;
+	settings.ns = 150;
+	settings.seed = 0;
+	settings.integrator.max_depth = 50;
+	settings.integrator.rr_min_depth = 3;
+	settings.adaptive.enabled = true;
+	settings.adaptive.max_spp = 4 * settings.ns;
+	settings.progressive = true;
+	settings.passSpp = 1;
+	bool benchmarkTraversal = false;
+	int outputFormats = image_ppm | image_pfm;
+	const int nx = settings.nx;
+	const int ny = settings.ny;
+	const int pixelCount = nx * ny;
+
+	const std::string sceneName = "cornell_box";
+	sampler sceneRng(settings.seed);
+	scene world;
+	scene_view view;
+	if (!load_scene(ScenePath(sceneName), sceneRng, world, view))
+		return 1;
+	camera cam = view.make_camera(nx, ny);
+
+	if (benchmarkTraversal)
 	{
-		fileHandler
-			<< ir.at(i) << " "
-			<< ig.at(i) << " "
-			<< ib.at(i) << "\n";
+		TraversalBenchmark(sceneName, world.world, cam, nx, ny);
+		sampler benchRng(settings.seed);
+		scene randomWorld;
+		scene_view randomView;
+		if (load_scene(ScenePath("random_scene"), benchRng, randomWorld, randomView))
+			TraversalBenchmark("random_scene", randomWorld.world, randomView.make_camera(nx, ny), nx, ny);
 	}
 
-	std::cout << "File Saved" << std::endl;
-	fileHandler.close();
-
+	Renderer renderer(settings, world, cam);
 
+	std::vector<vec3> preview(pixelCount, vec3(0, 0, 0));
+	std::mutex previewMutex;
+	std::atomic<int> previewVersion(0);
+	std::atomic<bool> renderFinished(false);
 
+	std::thread renderThread([&]() {
+		renderer.Render([&]() {
+			std::lock_guard<std::mutex> lock(previewMutex);
+			for (int i = 0; i < pixelCount; ++i)
+				preview[i] = GammaCorrect(renderer.accumulation[i]);
+			++previewVersion;
+			});
+		renderFinished = true;
+		});
+
+	image_writer writer;
+
+	// Runs once the render thread is done, whether it finished or was
+	// stopped by closing the window; the image is the average so far.
+	auto saveOutputs = [&]() {
+		renderThread.join();
+		renderer.PrintStats(std::cout);
+
+		// the writer thread tonemaps and encodes the snapshot while this
+		// thread carries on
+		std::shared_ptr<image> frame = renderer.Snapshot();
+		std::string filename =
+			"block-x" + std::to_string(nx)
+			+ "-y" + std::to_string(ny)
+			+ "-s" + std::to_string(settings.ns)
+			+ "-" + std::to_string(static_cast<int>(renderer.renderSeconds)) + "sec";
+		if (outputFormats & image_ppm)
+			writer.submit(frame, filename + ".ppm", image_ppm);
+		if (outputFormats & image_pfm)
+			writer.submit(frame, filename + ".pfm", image_pfm);
+		if (outputFormats & image_png)
+			writer.submit(frame, filename + ".png", image_png);
+
+		if (settings.adaptive.enabled)
+			writer.submit(renderer.SampleMap(), "samples-x" + std::to_string(nx) + "-y" + std::to_string(ny) + ".ppm",
+				image_ppm, image_tonemap::linear);
+	};
+
+	// the window opens straight away and shows the running average after
+	// every pass; closing it stops the render after the current pass
 	sf::RenderWindow window(sf::VideoMode(nx, ny), "Ray Tracer");
+	window.setFramerateLimit(30);
 	sf::VertexArray pointmap(sf::Points, nx * ny);
 	for (register int a = 0; a < nx * ny; a++) {
 		pointmap[a].position = sf::Vector2f(a % nx, (a / nx) % nx);
-		pointmap[a].color = sf::Color(ir.at(a), ig.at(a), ib.at(a));
+		pointmap[a].color = sf::Color::Black;
 	}
-	
 
+	int shownVersion = 0;
+	int shownTiles = -1;
+	bool saved = false;
 	while (window.isOpen())
 	{
 		sf::Event event;
@@ -361,12 +140,48 @@ int main()
 			//}
 		}
 
+		if (previewVersion != shownVersion)
+		{
+			std::lock_guard<std::mutex> lock(previewMutex);
+			shownVersion = previewVersion;
+			for (int a = 0; a < pixelCount; a++) {
+				// the buffer is stored bottom row first, the window top row first
+				const vec3& col = preview[(ny - 1 - a / nx) * nx + a % nx];
+				pointmap[a].color = sf::Color(
+					sf::Uint8(std::min(255, int(255.99f * col[0]))),
+					sf::Uint8(std::min(255, int(255.99f * col[1]))),
+					sf::Uint8(std::min(255, int(255.99f * col[2]))));
+			}
+		}
+
+		// progress within the pass comes from the workers' lock-free tile counter
+		int totalTiles = int(renderer.scheduler.tiles.size());
+		int tiles = renderFinished ? totalTiles : renderer.tilesCompleted.load(std::memory_order_acquire);
+		if (tiles != shownTiles)
+		{
+			shownTiles = tiles;
+			window.setTitle("Ray Tracer - pass " + std::to_string(shownVersion + (renderFinished ? 0 : 1))
+				+ ", tile " + std::to_string(tiles) + "/" + std::to_string(totalTiles));
+		}
+
+		if (renderFinished && !saved)
+		{
+			saveOutputs();
+			saved = true;
+		}
+
 		window.clear();
 		window.draw(pointmap);
 		window.display();
 	}
 
-	delete[] image;
+	if (!saved)
+	{
+		renderer.Stop();
+		saveOutputs();
+	}
+	writer.finish();
+
 	return 0;
 
 
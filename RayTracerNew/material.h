@@ -4,25 +4,51 @@
 #include "texture.h"
 #include "hittable.h"
 #include "random.h"
+#include "onb.h"
+
+struct bsdf_sample {
+    ray scattered;
+    vec3 weight;     // bsdf * cos / pdf, what the path throughput is scaled by
+    float pdf;       // solid angle density of the direction, 0 when specular
+    bool specular;   // a delta lobe that eval() and pdf() cannot see
+};
 
 class material {
 public:
     virtual bool scatter(
         const ray& r_in, const hit_record& rec, vec3& attenuation,
-        ray& scattered) const = 0;
+        ray& scattered, sampler& rng) const = 0;
     virtual vec3 emitted(float u, float v, const vec3& p) const {
         return vec3(0, 0, 0);
     }
+    virtual bool is_emissive() const { return false; }
+
+    // Sampling interface used for multiple importance sampling. By default a
+    // material is treated as specular: sample() wraps scatter() and eval()
+    // and pdf() are zero, so light sampling never applies to it.
+    virtual bool sample(const ray& r_in, const hit_record& rec, sampler& rng, bsdf_sample& s) const {
+        s.pdf = 0;
+        s.specular = true;
+        return scatter(r_in, rec, s.weight, s.scattered, rng);
+    }
+    virtual bool is_specular(const hit_record& rec) const { return true; }
+    // bsdf * cos for the unit direction wo
+    virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wo) const { return vec3(0, 0, 0); }
+    virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& wo) const { return 0; }
 };
 
-vec3 random_in_unit_sphere() {
+vec3 random_in_unit_sphere(sampler& rng) {
     vec3 p;
     do {
-        p = 2.0 * vec3(random_double(), random_double(), random_double()) - vec3(1, 1, 1);
+        p = 2.0 * vec3(rng.next_float(), rng.next_float(), rng.next_float()) - vec3(1, 1, 1);
     } while (p.squared_length() >= 1.0);
     return p;
 }
 
+vec3 random_unit_vector(sampler& rng) {
+    return unit_vector(random_in_unit_sphere(rng));
+}
+
 bool refract(const vec3& v, const vec3& n, float ni_over_nt, vec3& refracted) {
     vec3 uv = unit_vector(v);
     float dt = dot(uv, n);
@@ -44,12 +70,31 @@ float schlick(float cosine, float ref_idx) {
 class lambertian : public material {
 public:
     lambertian(texture* a) : albedo(a) {}
-    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const {
-        vec3 target = rec.p + rec.normal + random_in_unit_sphere();
-        scattered = ray(rec.p, target - rec.p, r_in.time());
+    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rng) const {
+        // normal plus a point on the unit sphere is cosine distributed, which
+        // is what the albedo / pi used by direct lighting assumes
+        vec3 direction = rec.normal + random_unit_vector(rng);
+        if (direction.squared_length() < 1e-6f)
+            direction = rec.normal;
+        scattered = ray(rec.p, direction, r_in.time());
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
+    virtual bool sample(const ray& r_in, const hit_record& rec, sampler& rng, bsdf_sample& s) const {
+        if (!scatter(r_in, rec, s.weight, s.scattered, rng))
+            return false;
+        s.pdf = pdf(r_in, rec, unit_vector(s.scattered.direction()));
+        s.specular = false;
+        return true;
+    }
+    virtual bool is_specular(const hit_record& rec) const { return false; }
+    virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wo) const {
+        return albedo->value(rec.u, rec.v, rec.p) * pdf(r_in, rec, wo);
+    }
+    virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& wo) const {
+        float cosine = dot(rec.normal, wo);
+        return cosine > 0 ? cosine / PI : 0;
+    }
 
     texture* albedo;
 };
@@ -57,8 +102,9 @@ public:
 class diffuse_light : public material {
 public:
     diffuse_light(texture* a) : emit(a) {}
-    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const { return false; }
+    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rng) const { return false; }
     virtual vec3 emitted(float u, float v, const vec3& p) const { return emit->value(u, v, p); }
+    virtual bool is_emissive() const { return true; }
     texture* emit;
 };
 
@@ -67,23 +113,66 @@ vec3 reflect(const vec3& v, const vec3& n) {
     return v - 2 * dot(v, n) * n;
 }
 
+// Fuzzy reflection as a Phong lobe around the mirror direction. The
+// exponent is chosen so the lobe's spread roughly matches the old
+// "reflect + fuzz * random_in_unit_sphere" look; fuzz 0 stays a mirror.
 class metal : public material {
 public:
-    metal(const vec3& a, float f) : albedo(a) { if (f < 1) fuzz = f; else fuzz = 1; }
-    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const {
+    metal(const vec3& a, float f) : albedo(a) {
+        if (f < 1) fuzz = f; else fuzz = 1;
+        exponent = fuzz > 0 ? 2 / (fuzz * fuzz) - 2 : 0;
+    }
+    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rng) const {
+        bsdf_sample s;
+        if (!sample(r_in, rec, rng, s))
+            return false;
+        attenuation = s.weight;
+        scattered = s.scattered;
+        return true;
+    }
+    virtual bool sample(const ray& r_in, const hit_record& rec, sampler& rng, bsdf_sample& s) const {
         vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflected + fuzz * random_in_unit_sphere());
-        attenuation = albedo;
-        return (dot(scattered.direction(), rec.normal) > 0);
+        s.weight = albedo;
+        if (fuzz <= 0) {
+            s.scattered = ray(rec.p, reflected, r_in.time());
+            s.pdf = 0;
+            s.specular = true;
+            return dot(reflected, rec.normal) > 0;
+        }
+        float cos_alpha = pow(rng.next_float(), 1 / (exponent + 1));
+        float sin_alpha = sqrt(ffmax(0.0f, 1 - cos_alpha * cos_alpha));
+        float phi = 2 * PI * rng.next_float();
+        onb uvw;
+        uvw.build_from_w(reflected);
+        vec3 direction = uvw.local(cos(phi) * sin_alpha, sin(phi) * sin_alpha, cos_alpha);
+        s.scattered = ray(rec.p, direction, r_in.time());
+        s.pdf = lobe(cos_alpha);
+        s.specular = false;
+        return dot(direction, rec.normal) > 0;
+    }
+    virtual bool is_specular(const hit_record& rec) const { return fuzz <= 0; }
+    virtual vec3 eval(const ray& r_in, const hit_record& rec, const vec3& wo) const {
+        return albedo * pdf(r_in, rec, wo);
     }
+    virtual float pdf(const ray& r_in, const hit_record& rec, const vec3& wo) const {
+        if (fuzz <= 0 || dot(wo, rec.normal) <= 0)
+            return 0;
+        vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+        return lobe(dot(reflected, wo));
+    }
+    float lobe(float cos_alpha) const {
+        return cos_alpha > 0 ? (exponent + 1) / (2 * PI) * pow(cos_alpha, exponent) : 0;
+    }
+
     vec3 albedo;
     float fuzz;
+    float exponent;
 };
 
 class dielectric : public material {
 public:
     dielectric(float ri) : ref_idx(ri) {}
-    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const {
+    virtual bool scatter(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered, sampler& rng) const {
         vec3 outward_normal;
         vec3 reflected = reflect(r_in.direction(), rec.normal);
         float ni_over_nt;
@@ -107,10 +196,10 @@ public:
             reflect_prob = schlick(cosine, ref_idx);
         else
             reflect_prob = 1.0;
-        if (random_double() < reflect_prob)
-            scattered = ray(rec.p, reflected);
+        if (rng.next_float() < reflect_prob)
+            scattered = ray(rec.p, reflected, r_in.time());
         else
-            scattered = ray(rec.p, refracted);
+            scattered = ray(rec.p, refracted, r_in.time());
         return true;
     }
 
@@ -0,0 +1,235 @@
+#pragma once
+#ifndef MESHCACHEH
+#define MESHCACHEH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Read-only mapping of a whole file. The pages stay valid until the object
+// is destroyed, so anything pointing into data() must not outlive it.
+class mapped_file {
+public:
+    mapped_file() {}
+    ~mapped_file() { close(); }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    const unsigned char* data() const { return static_cast<const unsigned char*>(ptr); }
+    size_t size() const { return length; }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+    void* ptr = nullptr;
+    size_t length = 0;
+};
+
+#ifdef _WIN32
+bool mapped_file::open(const std::string& path) {
+    close();
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        close();
+        return false;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        close();
+        return false;
+    }
+    ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (ptr == nullptr) {
+        close();
+        return false;
+    }
+    length = size_t(file_size.QuadPart);
+    return true;
+}
+
+void mapped_file::close() {
+    if (ptr)
+        UnmapViewOfFile(ptr);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+    ptr = nullptr;
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+    length = 0;
+}
+#else
+bool mapped_file::open(const std::string& path) {
+    close();
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close();
+        return false;
+    }
+    length = size_t(st.st_size);
+    ptr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+        ptr = nullptr;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void mapped_file::close() {
+    if (ptr)
+        munmap(ptr, length);
+    if (fd >= 0)
+        ::close(fd);
+    ptr = nullptr;
+    fd = -1;
+    length = 0;
+}
+#endif
+
+// Identifies the source file a cache was built from.
+struct mesh_cache_key {
+    uint64_t path_hash;
+    uint64_t size;
+    int64_t mtime;
+};
+
+bool mesh_cache_key_for(const std::string& path, mesh_cache_key& key) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path.c_str(), &st) != 0)
+        return false;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+#endif
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : path)
+        hash = (hash ^ uint8_t(c)) * 1099511628211ULL;
+    key.path_hash = hash;
+    key.size = uint64_t(st.st_size);
+    key.mtime = int64_t(st.st_mtime);
+    return true;
+}
+
+const uint32_t mesh_cache_version = 1;
+const int mesh_cache_max_blocks = 8;
+
+// The file is this header followed by raw arrays ("blocks"), each starting
+// on a 64 byte boundary so they can be used in place once mapped. What each
+// block holds is up to the caller; `layout` should change whenever the
+// in-memory element types do, so stale caches are rejected instead of misread.
+struct mesh_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;
+    mesh_cache_key key;
+    uint32_t counts[4];
+    uint64_t block_offset[mesh_cache_max_blocks];
+    uint64_t block_size[mesh_cache_max_blocks];
+};
+
+struct mesh_cache_block {
+    const void* data;
+    uint64_t size;
+};
+
+bool write_mesh_cache(const std::string& path, const mesh_cache_key& key, uint32_t layout,
+    const uint32_t counts[4], const mesh_cache_block* blocks, int n_blocks)
+{
+    mesh_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "RTMESH", 6);
+    header.version = mesh_cache_version;
+    header.layout = layout;
+    header.key = key;
+    for (int i = 0; i < 4; i++)
+        header.counts[i] = counts[i];
+
+    uint64_t offset = (sizeof(header) + 63) & ~uint64_t(63);
+    for (int i = 0; i < n_blocks; i++) {
+        header.block_offset[i] = offset;
+        header.block_size[i] = blocks[i].size;
+        offset = (offset + blocks[i].size + 63) & ~uint64_t(63);
+    }
+
+    // write next to the final name first so a crash never leaves a torn cache
+    std::string temp = path + ".tmp";
+    std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+        return false;
+    static const char zeros[64] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t written = sizeof(header);
+    for (int i = 0; i < n_blocks; i++) {
+        out.write(zeros, std::streamsize(header.block_offset[i] - written));
+        out.write(static_cast<const char*>(blocks[i].data), std::streamsize(blocks[i].size));
+        written = header.block_offset[i] + blocks[i].size;
+    }
+    out.close();
+    if (!out)
+        return false;
+    remove(path.c_str());
+    return rename(temp.c_str(), path.c_str()) == 0;
+}
+
+// Maps the cache and checks it was built from the same source with the same
+// layout, and that every block is aligned and inside the file. On success
+// the header (and the blocks after it) live in `file`; the caller still
+// has to check the block sizes against what the header's counts imply.
+const mesh_cache_header* open_mesh_cache(const std::string& path, const mesh_cache_key& key, uint32_t layout, mapped_file& file) {
+    if (!file.open(path))
+        return nullptr;
+    const mesh_cache_header* header = reinterpret_cast<const mesh_cache_header*>(file.data());
+    bool valid = file.size() >= sizeof(mesh_cache_header)
+        && memcmp(header->magic, "RTMESH", 6) == 0
+        && header->version == mesh_cache_version
+        && header->layout == layout
+        && header->key.path_hash == key.path_hash
+        && header->key.size == key.size
+        && header->key.mtime == key.mtime;
+    // written this way round so a huge offset or size can't wrap
+    for (int i = 0; valid && i < mesh_cache_max_blocks; i++)
+        valid = header->block_offset[i] % 64 == 0
+            && header->block_offset[i] <= file.size()
+            && header->block_size[i] <= file.size() - header->block_offset[i];
+    if (!valid) {
+        file.close();
+        return nullptr;
+    }
+    return header;
+}
+
+#endif
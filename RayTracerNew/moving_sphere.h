@@ -5,7 +5,7 @@
 class moving_sphere : public hittable {
 public:
     moving_sphere() {}
-    moving_sphere(vec3 cen0, vec3 cen1, float t0, float t1, float r, material* m)
+    moving_sphere(const vec3& cen0, const vec3& cen1, float t0, float t1, float r, material* m)
         : center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r), mat_ptr(m)
     {};
     virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
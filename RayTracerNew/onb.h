@@ -0,0 +1,25 @@
+#pragma once
+#ifndef ONBH
+#define ONBH
+
+#include "vec3.h"
+
+// Orthonormal basis around w, for sampling directions in a local frame.
+class onb {
+public:
+    onb() {}
+    void build_from_w(const vec3& n) {
+        axis[2] = unit_vector(n);
+        vec3 a = (fabs(w().x()) > 0.9f) ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        axis[1] = unit_vector(cross(w(), a));
+        axis[0] = cross(w(), v());
+    }
+    vec3 u() const { return axis[0]; }
+    vec3 v() const { return axis[1]; }
+    vec3 w() const { return axis[2]; }
+    vec3 local(float a, float b, float c) const { return a * u() + b * v() + c * w(); }
+
+    vec3 axis[3];
+};
+
+#endif
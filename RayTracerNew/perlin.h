@@ -54,20 +54,20 @@ public:
     static int* perm_z;
 };
 
-static vec3* perlin_generate() {
+static vec3* perlin_generate(sampler& rng) {
     vec3* p = new vec3[256];
     for (int i = 0; i < 256; ++i) {
-        double x_random = 2 * random_double() - 1;
-        double y_random = 2 * random_double() - 1;
-        double z_random = 2 * random_double() - 1;
+        float x_random = 2 * rng.next_float() - 1;
+        float y_random = 2 * rng.next_float() - 1;
+        float z_random = 2 * rng.next_float() - 1;
         p[i] = unit_vector(vec3(x_random, y_random, z_random));
     }
     return p;
 }
 
-void permute(int* p, int n) {
+void permute(int* p, int n, sampler& rng) {
     for (int i = n - 1; i > 0; i--) {
-        int target = int(random_double() * (i + 1));
+        int target = int(rng.next_float() * (i + 1));
         int tmp = p[i];
         p[i] = p[target];
         p[target] = tmp;
@@ -75,18 +75,19 @@ void permute(int* p, int n) {
     return;
 }
 
-static int* perlin_generate_perm() {
+static int* perlin_generate_perm(sampler& rng) {
     int* p = new int[256];
     for (int i = 0; i < 256; i++)
         p[i] = i;
-    permute(p, 256);
+    permute(p, 256, rng);
     return p;
 }
 
-vec3* perlin::ranvec = perlin_generate();
-int* perlin::perm_x = perlin_generate_perm();
-int* perlin::perm_y = perlin_generate_perm();
-int* perlin::perm_z = perlin_generate_perm();
+static sampler perlin_rng(0x5eed);
+vec3* perlin::ranvec = perlin_generate(perlin_rng);
+int* perlin::perm_x = perlin_generate_perm(perlin_rng);
+int* perlin::perm_y = perlin_generate_perm(perlin_rng);
+int* perlin::perm_z = perlin_generate_perm(perlin_rng);
 
 
 #endif
\ No newline at end of file
@@ -2,15 +2,52 @@
 #ifndef RANDOMH
 #define RANDOMH
 
-#include <functional>
-#include <random>
-
-inline double random_double() 
-{
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    static std::function<double()> rand_generator =
-        std::bind(distribution, generator);
-    return rand_generator();
+#include <stdint.h>
+
+// PCG32 generator (O'Neill, pcg-random.org). Sixteen bytes of state, so every
+// render thread keeps its own copy on the stack instead of sharing one engine.
+class sampler {
+public:
+    sampler() { seed(0, 0); }
+    sampler(uint64_t seed_value, uint64_t stream = 0) { seed(seed_value, stream); }
+
+    void seed(uint64_t seed_value, uint64_t stream) {
+        state = 0u;
+        inc = (stream << 1u) | 1u;
+        next_uint();
+        state += seed_value;
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = uint32_t(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+    }
+
+    // uniform in [0, 1)
+    float next_float() {
+        return float(next_uint() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    uint64_t state;
+    uint64_t inc;
+};
+
+// splitmix64 finalizer, used to decorrelate neighbouring pixel indices
+inline uint64_t hash_seed(uint64_t a, uint64_t b) {
+    uint64_t z = a + 0x9e3779b97f4a7c15ULL * (b + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// The sequence for a sample depends only on (seed, pixel, sample), so a frame
+// comes out bit-identical no matter how many threads render it.
+inline void seed_sample(sampler& rng, uint64_t seed, uint32_t pixel, uint32_t sample) {
+    rng.seed(hash_seed(seed, pixel), sample);
 }
-#endif
\ No newline at end of file
+
+#endif
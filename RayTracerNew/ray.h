@@ -2,20 +2,71 @@
 #ifndef RAYH
 #define RAYH
 #include "vec3.h"
+#include "simd.h"
 
+// Carries the reciprocal of its direction and which way each component
+// points, worked out once here instead of in every box test. A zero
+// component gives an infinite reciprocal, which the slab tests handle.
 class ray
 {
 public:
     ray() {}
-    ray(const vec3& a, const vec3& b, float ti = 0.0) { A = a; B = b; _time = ti; }
+    ray(const vec3& a, const vec3& b, float ti = 0.0) {
+        A = a;
+        B = b;
+        _time = ti;
+        for (int i = 0; i < 3; i++) {
+            inv_dir[i] = 1.0f / B[i];
+            sign[i] = inv_dir[i] < 0;
+        }
+    }
     vec3 origin() const { return A; }
     vec3 direction() const { return B; }
     float time() const { return _time; }
     vec3 point_at_parameter(float t) const { return A + t * B; }
+    // the same ray from another origin, keeping the reciprocals
+    ray moved(const vec3& origin) const {
+        ray r = *this;
+        r.A = origin;
+        return r;
+    }
 
     vec3 A;
     vec3 B;
     float _time;
+    vec3 inv_dir;
+    int sign[3];    // 1 where the direction is negative
+};
+
+// Up to four rays traced together through the BVH, e.g. the camera rays of
+// a 2x2 pixel block. The rays are kept as they are for the scalar fallback
+// and split by component for the SIMD tests; lanes outside `active` repeat
+// an active ray so they never produce NaN.
+struct ray4 {
+    ray4(const ray* r, int active) : active(active) {
+        int first = 0;
+        while (first < 3 && !(active >> first & 1))
+            first++;
+        for (int i = 0; i < 4; i++)
+            rays[i] = r[(active >> i & 1) ? i : first];
+        ox = float4(rays[0].A[0], rays[1].A[0], rays[2].A[0], rays[3].A[0]);
+        oy = float4(rays[0].A[1], rays[1].A[1], rays[2].A[1], rays[3].A[1]);
+        oz = float4(rays[0].A[2], rays[1].A[2], rays[2].A[2], rays[3].A[2]);
+        dx = float4(rays[0].B[0], rays[1].B[0], rays[2].B[0], rays[3].B[0]);
+        dy = float4(rays[0].B[1], rays[1].B[1], rays[2].B[1], rays[3].B[1]);
+        dz = float4(rays[0].B[2], rays[1].B[2], rays[2].B[2], rays[3].B[2]);
+        ix = float4(rays[0].inv_dir[0], rays[1].inv_dir[0], rays[2].inv_dir[0], rays[3].inv_dir[0]);
+        iy = float4(rays[0].inv_dir[1], rays[1].inv_dir[1], rays[2].inv_dir[1], rays[3].inv_dir[1]);
+        iz = float4(rays[0].inv_dir[2], rays[1].inv_dir[2], rays[2].inv_dir[2], rays[3].inv_dir[2]);
+        lead = first;
+    }
+
+    ray rays[4];
+    float4 ox, oy, oz;
+    float4 dx, dy, dz;
+    float4 ix, iy, iz;      // reciprocal directions
+    int active;
+    int lead;       // first active lane, whose direction orders the traversal
 };
 
 #endif // !RAYH
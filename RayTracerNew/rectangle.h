@@ -3,6 +3,7 @@
 #define RECTANGLEH
 
 #include "hittable.h"
+#include "material.h"
 
 
 class xy_rect : public hittable {
@@ -14,6 +15,9 @@ public:
         box = aabb(vec3(x0, y0, k - 0.0001), vec3(x1, y1, k + 0.0001));
         return true;
     }
+    virtual bool is_light() const { return mp->is_emissive(); }
+    virtual float pdf_value(const vec3& o, const vec3& v) const;
+    virtual vec3 random(const vec3& o, sampler& rng) const;
     material* mp;
     float x0, x1, y0, y1, k;
 };
@@ -27,6 +31,9 @@ public:
         box = aabb(vec3(x0, k - 0.0001, z0), vec3(x1, k + 0.0001, z1));
         return true;
     }
+    virtual bool is_light() const { return mp->is_emissive(); }
+    virtual float pdf_value(const vec3& o, const vec3& v) const;
+    virtual vec3 random(const vec3& o, sampler& rng) const;
     material* mp;
     float x0, x1, z0, z1, k;
 };
@@ -40,6 +47,9 @@ public:
         box = aabb(vec3(k - 0.0001, y0, z0), vec3(k + 0.0001, y1, z1));
         return true;
     }
+    virtual bool is_light() const { return mp->is_emissive(); }
+    virtual float pdf_value(const vec3& o, const vec3& v) const;
+    virtual vec3 random(const vec3& o, sampler& rng) const;
     material* mp;
     float y0, y1, z0, z1, k;
 };
@@ -49,7 +59,8 @@ public:
 
 bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
     float t = (k - r.origin().z()) / r.direction().z();
-    if (t < t0 || t > t1)
+    // written this way round so a NaN t (ray in the plane) is rejected too
+    if (!(t >= t0 && t <= t1))
         return false;
     float x = r.origin().x() + t * r.direction().x();
     float y = r.origin().y() + t * r.direction().y();
@@ -67,7 +78,8 @@ bool xy_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
 
 bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
     float t = (k - r.origin().y()) / r.direction().y();
-    if (t < t0 || t > t1)
+    // written this way round so a NaN t (ray in the plane) is rejected too
+    if (!(t >= t0 && t <= t1))
         return false;
     float x = r.origin().x() + t * r.direction().x();
     float z = r.origin().z() + t * r.direction().z();
@@ -84,7 +96,8 @@ bool xz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
 
 bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
     float t = (k - r.origin().x()) / r.direction().x();
-    if (t < t0 || t > t1)
+    // written this way round so a NaN t (ray in the plane) is rejected too
+    if (!(t >= t0 && t <= t1))
         return false;
     float y = r.origin().y() + t * r.direction().y();
     float z = r.origin().z() + t * r.direction().z();
@@ -99,4 +112,52 @@ bool yz_rect::hit(const ray& r, float t0, float t1, hit_record& rec) const {
     return true;
 }
 
+float xy_rect::pdf_value(const vec3& o, const vec3& v) const {
+    hit_record rec;
+    if (!xy_rect::hit(ray(o, v), 0.001, FLT_MAX, rec))
+        return 0;
+    float area = (x1 - x0) * (y1 - y0);
+    float distance_squared = rec.t * rec.t * v.squared_length();
+    float cosine = fabs(dot(v, rec.normal) / v.length());
+    return distance_squared / (cosine * area);
+}
+
+vec3 xy_rect::random(const vec3& o, sampler& rng) const {
+    float x = x0 + rng.next_float() * (x1 - x0);
+    float y = y0 + rng.next_float() * (y1 - y0);
+    return vec3(x, y, k) - o;
+}
+
+float xz_rect::pdf_value(const vec3& o, const vec3& v) const {
+    hit_record rec;
+    if (!xz_rect::hit(ray(o, v), 0.001, FLT_MAX, rec))
+        return 0;
+    float area = (x1 - x0) * (z1 - z0);
+    float distance_squared = rec.t * rec.t * v.squared_length();
+    float cosine = fabs(dot(v, rec.normal) / v.length());
+    return distance_squared / (cosine * area);
+}
+
+vec3 xz_rect::random(const vec3& o, sampler& rng) const {
+    float x = x0 + rng.next_float() * (x1 - x0);
+    float z = z0 + rng.next_float() * (z1 - z0);
+    return vec3(x, k, z) - o;
+}
+
+float yz_rect::pdf_value(const vec3& o, const vec3& v) const {
+    hit_record rec;
+    if (!yz_rect::hit(ray(o, v), 0.001, FLT_MAX, rec))
+        return 0;
+    float area = (y1 - y0) * (z1 - z0);
+    float distance_squared = rec.t * rec.t * v.squared_length();
+    float cosine = fabs(dot(v, rec.normal) / v.length());
+    return distance_squared / (cosine * area);
+}
+
+vec3 yz_rect::random(const vec3& o, sampler& rng) const {
+    float y = y0 + rng.next_float() * (y1 - y0);
+    float z = z0 + rng.next_float() * (z1 - z0);
+    return vec3(k, y, z) - o;
+}
+
 #endif // !RECTANGLEH
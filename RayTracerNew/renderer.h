@@ -0,0 +1,353 @@
+#pragma once
+#ifndef RENDERERH
+#define RENDERERH
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bvh.h"
+#include "camera.h"
+#include "integrator.h"
+#include "scene.h"
+#include "adaptive.h"
+#include "framebuffer.h"
+#include "image_io.h"
+#include "scheduler.h"
+
+// Casts one primary ray through the centre of every pixel and reports how
+// many BVH nodes get visited per ray, in build order and near-first order,
+// then how fast the same rays go through the binary and the four-wide tree
+// one at a time, and as 2x2 packets through whichever tree bvh_wide picks.
+void TraversalBenchmark(const std::string& name, hittable* world, const camera& cam, int nx, int ny)
+{
+	sampler rng;
+	std::vector<ray> rays;
+	rays.reserve(size_t(nx) * ny);
+	for (int j = 0; j < ny; ++j)
+		for (int i = 0; i < nx; ++i)
+			rays.push_back(cam.get_ray((i + 0.5f) / float(nx), (j + 0.5f) / float(ny), rng));
+
+	const int repeats = 4;
+	const double count = double(repeats) * nx * ny;
+	const bool wide = bvh_wide;
+	for (int pass = 0; pass < 3; ++pass) {
+		// build order, then near-first, binary; then near-first, four-wide
+		bvh_ordered_traversal = pass > 0;
+		bvh_wide = pass == 2;
+		if (bvh_wide && !wide)
+			break;
+		bvh_stats.nodes_visited = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int k = 0; k < repeats; ++k) {
+			for (const ray& r : rays) {
+				hit_record rec;
+				world->hit(r, 0.001, FLT_MAX, rec);
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << " - " << name << (pass == 0 ? " build order: " : pass == 1 ? " near-first: " : " bvh4: ")
+			<< double(bvh_stats.nodes_visited) / count << " nodes/ray, " << count / seconds * 1e-6 << " Mrays/s\n";
+	}
+	bvh_ordered_traversal = true;
+	bvh_wide = wide;
+
+	bvh_stats.nodes_visited = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int k = 0; k < repeats; ++k) {
+		for (int j = 0; j < ny; j += 2) {
+			for (int i = 0; i < nx; i += 2) {
+				ray block[4];
+				int active = 0;
+				for (int lane = 0; lane < 4; ++lane) {
+					int x = i + (lane & 1), y = j + (lane >> 1);
+					if (x < nx && y < ny) {
+						block[lane] = rays[size_t(y) * nx + x];
+						active |= 1 << lane;
+					}
+				}
+				float tMax[4] = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+				hit_record recs[4];
+				world->hit4(ray4(block, active), active, 0.001f, tMax, recs);
+			}
+		}
+	}
+	double packets = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << " - " << name << " 2x2 packets: " << double(bvh_stats.nodes_visited) / count * 4
+		<< " nodes/packet, " << count / packets * 1e-6 << " Mrays/s\n";
+}
+
+ray CameraRay(int i, int j, int s, uint64_t seed, int nx, int ny, const camera& cam, sampler& rng)
+{
+	seed_sample(rng, seed, j * nx + i, s);
+	float u = float(i + rng.next_float()) / float(nx);
+	float v = float(j + rng.next_float()) / float(ny);
+	return cam.get_ray(u, v, rng);
+}
+
+vec3 SamplePixel(int i, int j, int s, uint64_t seed, int nx, int ny, const camera& cam, const scene& world,
+	const integrator_settings& integrator, sampler& rng, path_counters& paths)
+{
+	ray r = CameraRay(i, j, s, seed, nx, ny, cam, rng);
+	return trace_path(r, world, integrator, rng, paths);
+}
+
+// Adds up to spp more samples to every pixel of the tile that still needs
+// them: pixels stop at maxSpp, or once converged when adaptive sampling is
+// on. Results go straight into the tile's own pixels of the framebuffer.
+// Sample s of a pixel is the same however the samples are split into
+// passes. Returns how many pixels got new samples.
+int CalculateColor(const tile& region, int spp, int maxSpp, uint64_t seed, framebuffer<pixel_estimate>& accumulation,
+	int nx, int ny, const camera& cam, const scene& world, const integrator_settings& integrator,
+	const adaptive_settings& adaptive, path_counters& paths)
+{
+	sampler rng;
+	int updated = 0;
+	for (int j = region.y0; j < region.y1; ++j) {
+		for (int i = region.x0; i < region.x1; ++i) {
+			pixel_estimate& estimate = accumulation(i, j);
+			if (adaptive.enabled && estimate.converged(adaptive))
+				continue;
+			int end = std::min(estimate.n + spp, maxSpp);
+			if (end <= estimate.n)
+				continue;
+			for (int s = estimate.n; s < end; ++s)
+				estimate.add(SamplePixel(i, j, s, seed, nx, ny, cam, world, integrator, rng, paths));
+			++updated;
+		}
+	}
+	return updated;
+}
+
+// CalculateColor with the camera rays of every 2x2 block of pixels traced as
+// one packet; the bounces after the first hit go one ray at a time, as they
+// scatter too much to share a walk through the BVH. Each lane keeps its own
+// sampler, so every sample comes out exactly as CalculateColor makes it.
+int CalculateColorPackets(const tile& region, int spp, int maxSpp, uint64_t seed, framebuffer<pixel_estimate>& accumulation,
+	int nx, int ny, const camera& cam, const scene& world, const integrator_settings& integrator,
+	const adaptive_settings& adaptive, path_counters& paths)
+{
+	int updated = 0;
+	for (int j = region.y0; j < region.y1; j += 2) {
+		for (int i = region.x0; i < region.x1; i += 2) {
+			pixel_estimate* estimates[4];
+			int first[4] = { 0, 0, 0, 0 };
+			int count[4] = { 0, 0, 0, 0 };
+			int longest = 0;
+			for (int lane = 0; lane < 4; ++lane) {
+				int x = i + (lane & 1), y = j + (lane >> 1);
+				if (x >= region.x1 || y >= region.y1)
+					continue;
+				estimates[lane] = &accumulation(x, y);
+				if (adaptive.enabled && estimates[lane]->converged(adaptive))
+					continue;
+				first[lane] = estimates[lane]->n;
+				count[lane] = std::max(0, std::min(first[lane] + spp, maxSpp) - first[lane]);
+				if (count[lane] > 0)
+					++updated;
+				longest = std::max(longest, count[lane]);
+			}
+			for (int k = 0; k < longest; ++k) {
+				ray rays[4];
+				sampler rngs[4];
+				int active = 0;
+				for (int lane = 0; lane < 4; ++lane) {
+					if (k < count[lane]) {
+						rays[lane] = CameraRay(i + (lane & 1), j + (lane >> 1), first[lane] + k, seed, nx, ny, cam, rngs[lane]);
+						active |= 1 << lane;
+					}
+				}
+				float tMax[4] = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+				hit_record recs[4];
+				int hits = world.world->hit4(ray4(rays, active), active, 0.001f, tMax, recs);
+				for (int lane = 0; lane < 4; ++lane) {
+					if (active >> lane & 1) {
+						primary_hit primary = { (hits >> lane & 1) != 0, recs[lane] };
+						estimates[lane]->add(trace_path(rays[lane], world, integrator, rngs[lane], paths, &primary));
+					}
+				}
+			}
+		}
+	}
+	return updated;
+}
+
+vec3 GammaCorrect(const pixel_estimate& estimate)
+{
+	vec3 col = estimate.mean();
+	return vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
+}
+
+// Everything about one render except the scene and the view.
+struct RenderSettings
+{
+	int nx = 600;
+	int ny = 400;
+	int ns = 150;
+	int threads = 0;		// 0 uses every hardware thread
+	int tileSize = 16;
+	uint64_t seed = 0;
+	// Progressive mode adds passSpp samples to the whole image per pass;
+	// otherwise a pixel gets all of its samples (or a whole adaptive batch)
+	// in a single pass.
+	bool progressive = true;
+	int passSpp = 1;
+	// trace camera rays in 2x2 packets (CalculateColorPackets). Off by
+	// default: only scenes of spheres or meshes, whose hit4 is vectorised,
+	// come out ahead of single rays through the four-wide BVH.
+	bool packets = false;
+	integrator_settings integrator;
+	adaptive_settings adaptive;
+};
+
+// The render core shared by the SFML viewer and the headless executable:
+// runs passes over the tiles until every pixel has its samples, and turns
+// the accumulation buffer into images. It knows nothing about windows.
+class Renderer
+{
+public:
+	Renderer(const RenderSettings& settings, const scene& world, const camera& cam);
+
+	// Blocks until the image is done or Stop() is called; onPass runs on
+	// the calling thread after every pass, e.g. to refresh a preview.
+	void Render(const std::function<void()>& onPass = nullptr);
+	void Stop() { stopRequested = true; }
+
+	path_counters PathCounters() const;
+	long long TotalSamples() const;
+	void PrintStats(std::ostream& os) const;
+	// linear averages in display order, top row first
+	std::shared_ptr<image> Snapshot() const;
+	// where the samples went, white at adaptive.max_spp
+	std::shared_ptr<image> SampleMap() const;
+
+	const RenderSettings settings;
+	framebuffer<pixel_estimate> accumulation;
+	tile_scheduler scheduler;
+	std::atomic<int> tilesCompleted;
+	std::atomic<int> pixelsUpdated;
+	std::atomic<bool> stopRequested;
+	int passes;
+	double renderSeconds;
+
+private:
+	// one counter block per worker, padded so no two share a cache line
+	// (std::vector can't be relied on for alignas(64) before C++17)
+	struct WorkerCounters
+	{
+		path_counters paths;
+		char pad[64];
+	};
+
+	const scene world;
+	const camera cam;
+	std::vector<WorkerCounters> workerCounters;
+};
+
+Renderer::Renderer(const RenderSettings& settings, const scene& world, const camera& cam)
+	: settings(settings), accumulation(settings.nx, settings.ny),
+	scheduler(settings.nx, settings.ny, settings.tileSize,
+		settings.threads > 0 ? settings.threads : int(std::max(1u, std::thread::hardware_concurrency()))),
+	tilesCompleted(0), pixelsUpdated(0), stopRequested(false), passes(0), renderSeconds(0.0),
+	world(world), cam(cam), workerCounters(scheduler.workers)
+{
+}
+
+void Renderer::Render(const std::function<void()>& onPass)
+{
+	const int maxSpp = settings.adaptive.enabled ? settings.adaptive.max_spp : settings.ns;
+	const int samplesPerPass = settings.progressive ? settings.passSpp
+		: (settings.adaptive.enabled ? settings.adaptive.batch_spp : settings.ns);
+
+	auto fulltime = std::chrono::high_resolution_clock::now();
+	while (!stopRequested)
+	{
+		tilesCompleted = 0;
+		pixelsUpdated = 0;
+		// tiles are handed out through per-thread deques and stolen by idle
+		// threads, so the costly rows around the light don't stall the frame
+		scheduler.run([&](const tile& region, int worker) {
+			int updated = (settings.packets ? CalculateColorPackets : CalculateColor)(region, samplesPerPass, maxSpp, settings.seed,
+				accumulation, settings.nx, settings.ny, cam, world, settings.integrator, settings.adaptive, workerCounters[worker].paths);
+			pixelsUpdated.fetch_add(updated, std::memory_order_relaxed);
+			tilesCompleted.fetch_add(1, std::memory_order_release);
+			});
+
+		if (pixelsUpdated == 0)
+			break;
+		++passes;
+		if (onPass)
+			onPass();
+	}
+	renderSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - fulltime).count();
+}
+
+path_counters Renderer::PathCounters() const
+{
+	path_counters paths;
+	for (const WorkerCounters& counters : workerCounters)
+	{
+		paths.paths += counters.paths.paths;
+		paths.segments += counters.paths.segments;
+	}
+	return paths;
+}
+
+long long Renderer::TotalSamples() const
+{
+	long long totalSamples = 0;
+	for (int i = 0; i < settings.nx * settings.ny; ++i)
+		totalSamples += accumulation[i].n;
+	return totalSamples;
+}
+
+void Renderer::PrintStats(std::ostream& os) const
+{
+	const int pixelCount = settings.nx * settings.ny;
+	const integrator_settings& integrator = settings.integrator;
+	const adaptive_settings& adaptive = settings.adaptive;
+	path_counters paths = PathCounters();
+	os << " - time " << renderSeconds << " s\n";
+	scheduler.print_stats(os);
+	os << " - " << passes << " passes" << (stopRequested ? " (stopped early)" : "") << "\n";
+	os << " - average path length " << double(paths.segments) / double(paths.paths) << " segments, "
+		<< double(paths.segments) / double(pixelCount) << " per pixel ("
+		<< (integrator.russian_roulette ? "russian roulette from depth " + std::to_string(integrator.rr_min_depth) : std::string("no russian roulette"))
+		<< ", max depth " << integrator.max_depth << ")\n";
+	os << " - " << double(TotalSamples()) / double(pixelCount) << " samples per pixel"
+		<< (adaptive.enabled ? " (adaptive, " + std::to_string(adaptive.min_spp) + " to " + std::to_string(adaptive.max_spp) + ")" : std::string()) << "\n";
+}
+
+std::shared_ptr<image> Renderer::Snapshot() const
+{
+	const int pixelCount = settings.nx * settings.ny;
+	std::shared_ptr<image> frame = std::make_shared<image>(settings.nx, settings.ny);
+	for (int i = 0; i < pixelCount; ++i)
+	{
+		vec3 col = accumulation(i % settings.nx, settings.ny - 1 - i / settings.nx).mean();
+		float* out = frame->pixel(i);
+		out[0] = col[0];
+		out[1] = col[1];
+		out[2] = col[2];
+	}
+	return frame;
+}
+
+std::shared_ptr<image> Renderer::SampleMap() const
+{
+	const int pixelCount = settings.nx * settings.ny;
+	std::shared_ptr<image> map = std::make_shared<image>(settings.nx, settings.ny);
+	for (int i = 0; i < pixelCount; ++i)
+	{
+		float level = float(accumulation(i % settings.nx, settings.ny - 1 - i / settings.nx).n) / float(settings.adaptive.max_spp);
+		float* out = map->pixel(i);
+		out[0] = out[1] = out[2] = level;
+	}
+	return map;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef SCENEH
+#define SCENEH
+
+#include "hittable.h"
+#include "arena.h"
+#include <memory>
+#include <vector>
+
+class linear_bvh;
+
+// Emitters sampled by next-event estimation. One light is picked uniformly,
+// so the density of a direction is the average of every light's pdf.
+class light_list {
+public:
+    bool empty() const { return lights.empty(); }
+    float pdf_value(const vec3& o, const vec3& v) const;
+    vec3 random(const vec3& o, sampler& rng) const;
+
+    std::vector<hittable*> lights;
+};
+
+float light_list::pdf_value(const vec3& o, const vec3& v) const {
+    float sum = 0;
+    for (hittable* light : lights)
+        sum += light->pdf_value(o, v);
+    return sum / float(lights.size());
+}
+
+vec3 light_list::random(const vec3& o, sampler& rng) const {
+    int n = int(lights.size());
+    int index = int(rng.next_float() * n);
+    return lights[index < n ? index : n - 1]->random(o, rng);
+}
+
+// Picks the emitters out of a scene's top level objects. Emitters hidden
+// inside composite objects (a box, a Model) are not sampled directly; paths
+// still find them by scattering.
+light_list collect_lights(hittable** list, int n) {
+    light_list lights;
+    for (int i = 0; i < n; i++)
+        if (list[i]->is_light())
+            lights.lights.push_back(list[i]);
+    return lights;
+}
+
+// A loaded scene. Every object, material, texture and BVH it points to
+// lives in `memory` and goes with the last copy of the scene.
+struct scene {
+    hittable* world;
+    linear_bvh* bvh = nullptr;  // the world's top level BVH, refit for each frame
+    light_list lights;
+    std::shared_ptr<arena> memory;
+    size_t memory_bytes = 0;    // arena, BVH nodes and meshes
+};
+
+#endif
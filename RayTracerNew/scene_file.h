@@ -0,0 +1,472 @@
+#pragma once
+#ifndef SCENEFILEH
+#define SCENEFILEH
+
+// Text scene description, one statement per line, '#' starts a comment:
+//
+//   camera lookfrom X Y Z lookat X Y Z [vup X Y Z] [fov DEG] [aperture A]
+//          [focus D] [time T0 T1]
+//   texture NAME constant R G B | checker TEX TEX | image PATH
+//   material NAME lambertian (R G B | TEX) | metal R G B FUZZ
+//            | dielectric IOR | light (R G B | TEX)
+//   sphere X Y Z RADIUS MAT
+//   moving_sphere X0 Y0 Z0 X1 Y1 Z1 T0 T1 RADIUS MAT
+//   xy_rect X0 X1 Y0 Y1 Z MAT [flip]      (and xz_rect, yz_rect)
+//   box X0 Y0 Z0 X1 Y1 Z1 MAT
+//   mesh NAME DIR FILE MAT                 loads an obj once, place it with instance
+//   object NAME ... end                    named group with its own BVH
+//   instance NAME [MAT]                    places a mesh or object, MAT overrides
+//   translate X Y Z | rotate_y DEG | scale S | scale X Y Z | push | pop
+//
+// Transforms apply to everything after them until the matching pop, the last
+// one given acting first. Transformed primitives are wrapped in an instance.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sphere.h"
+#include "moving_sphere.h"
+#include "rectangle.h"
+#include "box.h"
+#include "camera.h"
+#include "material.h"
+#include "texture.h"
+#include "bvh.h"
+#include "stb_image.h"
+#include "Model.h"
+#include "instance.h"
+#include "scene.h"
+#include "transform.h"
+
+// The camera a scene file asks for.
+struct scene_view {
+    vec3 lookfrom = vec3(0, 0, 0);
+    vec3 lookat = vec3(0, 0, -1);
+    vec3 vup = vec3(0, 1, 0);
+    float fov = 40.0f;
+    float aperture = 0.0f;
+    float dist_to_focus = 10.0f;
+    float time0 = 0.0f;
+    float time1 = 1.0f;
+
+    camera make_camera(int nx, int ny) const {
+        return camera(lookfrom, lookat, vup, fov, float(nx) / float(ny), aperture, dist_to_focus, time0, time1);
+    }
+};
+
+class scene_parser {
+public:
+    scene_parser(const std::string& path, sampler& rng) : path(path), rng(rng), memory(nullptr) {}
+    bool parse(scene& world, scene_view& view);
+
+private:
+    struct transform_state {
+        affine3 to_world;
+        bool identity;
+    };
+
+    bool statement(scene_view& view);
+    bool fail(const std::string& message);
+    bool count(size_t n);
+    bool number(size_t i, float& out);
+    bool numbers(size_t first, size_t n, float* out);
+    bool find_texture(size_t i, texture*& out);
+    bool find_material(size_t i, material*& out);
+    bool color_or_texture(size_t i, texture*& out);
+    void add(hittable* h);
+
+    std::string path;
+    sampler& rng;
+    arena* memory;
+    std::vector<char*> tokens;
+    int line = 0;
+    std::unordered_map<std::string, texture*> textures;
+    std::unordered_map<std::string, material*> materials;
+    // What instance places: the geometry, and the material to put on it
+    // when that differs from the geometry's own.
+    struct placeable {
+        hittable* geometry;
+        material* mat;
+    };
+    std::unordered_map<std::string, placeable> geometry;
+    std::unordered_map<std::string, Model*> models;
+    std::vector<transform_state> transforms;
+    std::vector<hittable*> top;
+    std::vector<hittable*> object;
+    std::string object_name;
+    bool in_object = false;
+    int primitives = 0;
+    size_t bvh_bytes = 0;
+};
+
+bool scene_parser::fail(const std::string& message) {
+    std::cerr << path << ":" << line << ": " << message << "\n";
+    return false;
+}
+
+bool scene_parser::count(size_t n) {
+    if (tokens.size() == n)
+        return true;
+    return fail(std::string(tokens[0]) + " takes " + std::to_string(n - 1) + " values, got " + std::to_string(tokens.size() - 1));
+}
+
+bool scene_parser::number(size_t i, float& out) {
+    char* end;
+    out = strtof(tokens[i], &end);
+    if (*end == '\0' && end != tokens[i])
+        return true;
+    return fail(std::string("expected a number, got '") + tokens[i] + "'");
+}
+
+bool scene_parser::numbers(size_t first, size_t n, float* out) {
+    for (size_t i = 0; i < n; i++)
+        if (!number(first + i, out[i]))
+            return false;
+    return true;
+}
+
+bool scene_parser::find_texture(size_t i, texture*& out) {
+    auto it = textures.find(tokens[i]);
+    if (it == textures.end())
+        return fail(std::string("unknown texture '") + tokens[i] + "'");
+    out = it->second;
+    return true;
+}
+
+bool scene_parser::find_material(size_t i, material*& out) {
+    auto it = materials.find(tokens[i]);
+    if (it == materials.end())
+        return fail(std::string("unknown material '") + tokens[i] + "'");
+    out = it->second;
+    return true;
+}
+
+// either three numbers for a constant colour or one texture name
+bool scene_parser::color_or_texture(size_t i, texture*& out) {
+    if (tokens.size() == i + 1)
+        return find_texture(i, out);
+    float c[3];
+    if (tokens.size() != i + 3 || !numbers(i, 3, c))
+        return fail("expected R G B or a texture name");
+    out = memory->make<constant_texture>(vec3(c[0], c[1], c[2]));
+    return true;
+}
+
+void scene_parser::add(hittable* h) {
+    const transform_state& current = transforms.back();
+    if (!current.identity) {
+        h = memory->make<instance>(h, current.to_world);
+    }
+    (in_object ? object : top).push_back(h);
+    primitives++;
+}
+
+bool scene_parser::statement(scene_view& view) {
+    const std::string keyword = tokens[0];
+    float v[10];
+    material* mat;
+
+    if (keyword == "sphere") {
+        if (!count(6) || !numbers(1, 4, v) || !find_material(5, mat))
+            return false;
+        add(memory->make<sphere>(vec3(v[0], v[1], v[2]), v[3], mat));
+    }
+    else if (keyword == "moving_sphere") {
+        if (!count(11) || !numbers(1, 9, v) || !find_material(10, mat))
+            return false;
+        add(memory->make<moving_sphere>(vec3(v[0], v[1], v[2]), vec3(v[3], v[4], v[5]), v[6], v[7], v[8], mat));
+    }
+    else if (keyword == "xy_rect" || keyword == "xz_rect" || keyword == "yz_rect") {
+        bool flip = tokens.size() == 8 && strcmp(tokens[7], "flip") == 0;
+        if (!flip && !count(7))
+            return false;
+        if (!numbers(1, 5, v) || !find_material(6, mat))
+            return false;
+        hittable* rect;
+        if (keyword == "xy_rect") {
+            rect = memory->make<xy_rect>(v[0], v[1], v[2], v[3], v[4], mat);
+        }
+        else if (keyword == "xz_rect") {
+            rect = memory->make<xz_rect>(v[0], v[1], v[2], v[3], v[4], mat);
+        }
+        else {
+            rect = memory->make<yz_rect>(v[0], v[1], v[2], v[3], v[4], mat);
+        }
+        if (flip) {
+            rect = memory->make<flip_normals>(rect);
+        }
+        add(rect);
+    }
+    else if (keyword == "box") {
+        if (!count(8) || !numbers(1, 6, v) || !find_material(7, mat))
+            return false;
+        add(memory->make<box>(vec3(v[0], v[1], v[2]), vec3(v[3], v[4], v[5]), mat));
+    }
+    else if (keyword == "instance") {
+        if (tokens.size() != 2 && !count(3))
+            return false;
+        auto it = geometry.find(tokens[1]);
+        if (it == geometry.end())
+            return fail(std::string("unknown mesh or object '") + tokens[1] + "'");
+        mat = it->second.mat;
+        if (tokens.size() == 3 && !find_material(2, mat))
+            return false;
+        const transform_state& current = transforms.back();
+        if (current.identity && !mat) {
+            (in_object ? object : top).push_back(it->second.geometry);
+        }
+        else {
+            (in_object ? object : top).push_back(memory->make<instance>(it->second.geometry, current.to_world, mat));
+        }
+        primitives++;
+    }
+    else if (keyword == "material") {
+        if (tokens.size() < 3)
+            return fail("material needs a name and a type");
+        const std::string type = tokens[2];
+        texture* tex;
+        if (type == "lambertian") {
+            if (!color_or_texture(3, tex))
+                return false;
+            mat = memory->make<lambertian>(tex);
+        }
+        else if (type == "metal") {
+            if (!count(7) || !numbers(3, 4, v))
+                return false;
+            mat = memory->make<metal>(vec3(v[0], v[1], v[2]), v[3]);
+        }
+        else if (type == "dielectric") {
+            if (!count(4) || !number(3, v[0]))
+                return false;
+            mat = memory->make<dielectric>(v[0]);
+        }
+        else if (type == "light") {
+            if (!color_or_texture(3, tex))
+                return false;
+            mat = memory->make<diffuse_light>(tex);
+        }
+        else {
+            return fail("unknown material type '" + type + "'");
+        }
+        materials[tokens[1]] = mat;
+    }
+    else if (keyword == "texture") {
+        if (tokens.size() < 3)
+            return fail("texture needs a name and a type");
+        const std::string type = tokens[2];
+        texture* tex;
+        if (type == "constant") {
+            if (!count(6) || !numbers(3, 3, v))
+                return false;
+            tex = memory->make<constant_texture>(vec3(v[0], v[1], v[2]));
+        }
+        else if (type == "checker") {
+            texture* even;
+            texture* odd;
+            if (!count(5) || !find_texture(3, even) || !find_texture(4, odd))
+                return false;
+            tex = memory->make<checker_texture>(even, odd);
+        }
+        else if (type == "image") {
+            if (!count(4))
+                return false;
+            int nx, ny, nn;
+            unsigned char* data = stbi_load(tokens[3], &nx, &ny, &nn, 0);
+            if (!data)
+                return fail(std::string("could not load image '") + tokens[3] + "'");
+            memory->on_release(stbi_image_free, data);
+            tex = memory->make<image_texture>(data, nx, ny);
+        }
+        else {
+            return fail("unknown texture type '" + type + "'");
+        }
+        textures[tokens[1]] = tex;
+    }
+    else if (keyword == "mesh") {
+        if (!count(5) || !find_material(4, mat))
+            return false;
+        // one Model per file and scene; place the copies with instance. A
+        // second mesh of the same file with another material shares the
+        // triangles and has its instances override the material.
+        Model*& model = models[std::string(tokens[2]) + tokens[3]];
+        if (!model)
+            model = memory->make<Model>(tokens[2], tokens[3], mat);
+        geometry[tokens[1]] = placeable{ model, mat != model->m_material ? mat : nullptr };
+    }
+    else if (keyword == "object") {
+        if (!count(2))
+            return false;
+        if (in_object)
+            return fail("objects cannot be nested");
+        in_object = true;
+        object_name = tokens[1];
+        object.clear();
+    }
+    else if (keyword == "end") {
+        if (!count(1))
+            return false;
+        if (!in_object)
+            return fail("end without object");
+        if (object.empty())
+            return fail("object '" + object_name + "' is empty");
+        in_object = false;
+        linear_bvh* bvh = build_bvh(object.data(), int(object.size()), view.time0, view.time1, rng, *memory);
+        bvh_bytes += bvh->tree.memory_bytes() + bvh->tree.wide_bytes();
+        geometry[object_name] = placeable{ bvh, nullptr };
+    }
+    else if (keyword == "translate" || keyword == "rotate_y" || keyword == "scale") {
+        affine3 t;
+        if (keyword == "translate") {
+            if (!count(4) || !numbers(1, 3, v))
+                return false;
+            t = affine3::translation(vec3(v[0], v[1], v[2]));
+        }
+        else if (keyword == "rotate_y") {
+            if (!count(2) || !number(1, v[0]))
+                return false;
+            t = affine3::rotation_y(v[0]);
+        }
+        else if (tokens.size() == 2) {
+            if (!number(1, v[0]))
+                return false;
+            t = affine3::scaling(vec3(v[0], v[0], v[0]));
+        }
+        else {
+            if (!count(4) || !numbers(1, 3, v))
+                return false;
+            t = affine3::scaling(vec3(v[0], v[1], v[2]));
+        }
+        transform_state& current = transforms.back();
+        current.to_world = current.to_world * t;
+        current.identity = false;
+    }
+    else if (keyword == "push") {
+        if (!count(1))
+            return false;
+        transforms.push_back(transforms.back());
+    }
+    else if (keyword == "pop") {
+        if (!count(1))
+            return false;
+        if (transforms.size() == 1)
+            return fail("pop without push");
+        transforms.pop_back();
+    }
+    else if (keyword == "camera") {
+        for (size_t i = 1; i < tokens.size(); ) {
+            const std::string key = tokens[i];
+            size_t n = key == "lookfrom" || key == "lookat" || key == "vup" ? 3
+                : key == "time" ? 2
+                : key == "fov" || key == "aperture" || key == "focus" ? 1 : 0;
+            if (n == 0)
+                return fail("unknown camera setting '" + key + "'");
+            if (i + n >= tokens.size() || !numbers(i + 1, n, v))
+                return fail("camera " + key + " takes " + std::to_string(n) + " values");
+            if (key == "lookfrom")
+                view.lookfrom = vec3(v[0], v[1], v[2]);
+            else if (key == "lookat")
+                view.lookat = vec3(v[0], v[1], v[2]);
+            else if (key == "vup")
+                view.vup = vec3(v[0], v[1], v[2]);
+            else if (key == "time") {
+                view.time0 = v[0];
+                view.time1 = v[1];
+            }
+            else if (key == "fov")
+                view.fov = v[0];
+            else if (key == "aperture")
+                view.aperture = v[0];
+            else
+                view.dist_to_focus = v[0];
+            i += n + 1;
+        }
+    }
+    else {
+        return fail("unknown statement '" + keyword + "'");
+    }
+    return true;
+}
+
+// Reads the whole file in one go and splits it in place, so tokens are
+// pointers into the buffer and numbers are parsed without copies. Every
+// primitive is built into the scene's arena as its line is read; the scene
+// BVH is built once at the end.
+bool scene_parser::parse(scene& world, scene_view& view) {
+    auto start = std::chrono::high_resolution_clock::now();
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        std::cerr << "could not open scene " << path << "\n";
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    std::vector<char> text(size_t(size) + 1);
+    size_t read = fread(text.data(), 1, size_t(size), file);
+    fclose(file);
+    text[read] = '\0';
+
+    world.memory = std::make_shared<arena>();
+    memory = world.memory.get();
+    transforms.assign(1, transform_state{ affine3::identity(), true });
+    char* p = text.data();
+    while (*p) {
+        line++;
+        tokens.clear();
+        bool comment = false;
+        while (*p && *p != '\n') {
+            if (*p == '#')
+                comment = true;
+            if (comment || *p == ' ' || *p == '\t' || *p == '\r') {
+                *p++ = '\0';
+                continue;
+            }
+            tokens.push_back(p);
+            while (*p && *p != '\n' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#')
+                p++;
+        }
+        if (*p == '\n')
+            *p++ = '\0';
+        if (!tokens.empty() && !statement(view))
+            return false;
+    }
+    if (in_object)
+        return fail("object '" + object_name + "' is missing its end");
+    if (top.empty())
+        return fail("the scene is empty");
+    double parse_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << " - scene " << path << ": " << primitives << " primitives, " << materials.size() << " materials, "
+        << textures.size() << " textures, parsed in " << parse_ms << " ms\n";
+
+    linear_bvh* bvh = build_bvh(top.data(), int(top.size()), view.time0, view.time1, rng, *memory);
+    bvh_bytes += bvh->tree.memory_bytes() + bvh->tree.wide_bytes();
+    world.world = bvh;
+    world.bvh = bvh;
+    world.lights = collect_lights(top.data(), int(top.size()));
+
+    size_t mesh_bytes = 0;
+    for (const auto& model : models) {
+        mesh_bytes += model.second->MemoryBytes();
+        bvh_bytes += model.second->BvhBytes();
+    }
+    world.memory_bytes = memory->bytes_used() + bvh_bytes + mesh_bytes;
+    std::cout << " - scene memory " << float(world.memory_bytes) / 1024 << " KB: "
+        << memory->object_count() << " objects in " << float(memory->bytes_used()) / 1024 << " KB ("
+        << memory->block_count() << " arena blocks), bvh nodes " << float(bvh_bytes) / 1024
+        << " KB, meshes " << float(mesh_bytes) / 1024 << " KB\n";
+    return true;
+}
+
+// Loads a scene file into world and view. Prints file:line and returns
+// false on the first error.
+bool load_scene(const std::string& path, sampler& rng, scene& world, scene_view& view) {
+    scene_parser parser(path, rng);
+    return parser.parse(world, view);
+}
+
+#endif
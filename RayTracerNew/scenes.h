@@ -0,0 +1,20 @@
+#pragma once
+#ifndef SCENESH
+#define SCENESH
+
+#include <string>
+#include "scene_file.h"
+
+// The sample scenes shipped in scenes/, which double as benchmarks.
+const char* const sceneNames[] = { "earth", "two_spheres", "random_scene", "cornell_box", "instance_field" };
+
+// A name from sceneNames, or the path of any .scene file.
+std::string ScenePath(const std::string& name)
+{
+	const std::string extension = ".scene";
+	if (name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+		return name;
+	return "scenes/" + name + extension;
+}
+
+#endif
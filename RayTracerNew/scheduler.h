@@ -0,0 +1,203 @@
+#pragma once
+#ifndef SCHEDULERH
+#define SCHEDULERH
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct tile {
+    int x0, y0;
+    int x1, y1;
+};
+
+struct worker_stats {
+    double busy_ms = 0.0;
+    double idle_ms = 0.0;
+    int tiles = 0;
+    int steals = 0;
+};
+
+// Splits the frame into small tiles and hands each worker a contiguous run of
+// them in its own deque. A worker pops from the back of its deque; once that
+// is empty it steals from the front of another worker's deque, so rows that
+// see the expensive parts of the scene get spread over every core.
+//
+// The worker threads start with the scheduler and sleep on a condition
+// variable between passes, so a progressive render doesn't pay for thread
+// creation every pass and idle workers don't spin.
+class tile_scheduler {
+public:
+    tile_scheduler(int nx, int ny, int tile_size, int n_workers);
+    ~tile_scheduler();
+    tile_scheduler(const tile_scheduler&) = delete;
+    tile_scheduler& operator=(const tile_scheduler&) = delete;
+
+    // render_tile(const tile&, int worker) is called once for every tile;
+    // returns when all of them are done.
+    template <typename F>
+    void run(F&& render_tile);
+    void print_stats(std::ostream& os) const;
+
+    std::vector<tile> tiles;
+    std::vector<worker_stats> stats;
+    int workers;
+    double frame_ms;
+
+private:
+    // Padded rather than alignas(64): new[] of an over-aligned type is
+    // C++17. The padding keeps one queue's lock off its neighbour's line.
+    struct work_queue {
+        std::mutex mutex;
+        std::deque<tile> tiles;
+        char pad[64];
+    };
+
+    void work(int w);
+    bool pop_local(int w, tile& t);
+    bool steal(int w, tile& t);
+
+    std::unique_ptr<work_queue[]> queues;
+    std::function<void(const tile&, int)> job;
+    std::mutex mutex;
+    std::condition_variable wake;       // a pass started, or shutdown
+    std::condition_variable finished;   // the last worker ran out of tiles
+    unsigned pass = 0;
+    int running = 0;                    // workers still in the current pass
+    bool shutdown = false;
+    std::vector<std::thread> threads;   // last, so they start after the rest
+};
+
+tile_scheduler::tile_scheduler(int nx, int ny, int tile_size, int n_workers)
+    : workers(std::max(1, n_workers)), frame_ms(0.0), queues(new work_queue[std::max(1, n_workers)])
+{
+    for (int y = 0; y < ny; y += tile_size)
+        for (int x = 0; x < nx; x += tile_size)
+            tiles.push_back({ x, y, std::min(x + tile_size, nx), std::min(y + tile_size, ny) });
+    stats.resize(workers);
+    for (int w = 0; w < workers; ++w)
+        threads.emplace_back([this, w]() { work(w); });
+}
+
+tile_scheduler::~tile_scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shutdown = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : threads)
+        t.join();
+}
+
+bool tile_scheduler::pop_local(int w, tile& t) {
+    std::lock_guard<std::mutex> lock(queues[w].mutex);
+    if (queues[w].tiles.empty())
+        return false;
+    t = queues[w].tiles.back();
+    queues[w].tiles.pop_back();
+    return true;
+}
+
+bool tile_scheduler::steal(int w, tile& t) {
+    for (int i = 1; i < workers; ++i) {
+        work_queue& victim = queues[(w + i) % workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tiles.empty()) {
+            t = victim.tiles.front();
+            victim.tiles.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void tile_scheduler::work(int w) {
+    typedef std::chrono::high_resolution_clock clock;
+    unsigned seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return shutdown || pass != seen; });
+            if (shutdown)
+                return;
+            seen = pass;
+        }
+        // tiles are only ever taken, so once every deque is empty the
+        // pass has nothing left for this worker
+        worker_stats& s = stats[w];
+        tile t;
+        for (;;) {
+            bool stolen = false;
+            if (!pop_local(w, t)) {
+                if (!steal(w, t))
+                    break;
+                stolen = true;
+            }
+            auto start = clock::now();
+            job(t, w);
+            s.busy_ms += std::chrono::duration<double, std::milli>(clock::now() - start).count();
+            s.tiles++;
+            if (stolen)
+                s.steals++;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--running == 0)
+            finished.notify_one();
+    }
+}
+
+template <typename F>
+void tile_scheduler::run(F&& render_tile) {
+    typedef std::chrono::high_resolution_clock clock;
+
+    // the workers are asleep, so the queues can be filled without locks;
+    // bumping `pass` under the mutex publishes them
+    const int n = int(tiles.size());
+    for (int w = 0; w < workers; ++w) {
+        queues[w].tiles.assign(tiles.begin() + size_t(n) * w / workers,
+            tiles.begin() + size_t(n) * (w + 1) / workers);
+        stats[w] = worker_stats();
+    }
+    job = std::ref(render_tile);
+
+    auto frame_start = clock::now();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        pass++;
+        running = workers;
+        wake.notify_all();
+        finished.wait(lock, [this]() { return running == 0; });
+    }
+    frame_ms = std::chrono::duration<double, std::milli>(clock::now() - frame_start).count();
+    job = nullptr;
+
+    for (worker_stats& s : stats)
+        s.idle_ms = std::max(0.0, frame_ms - s.busy_ms);
+}
+
+void tile_scheduler::print_stats(std::ostream& os) const {
+    std::ios_base::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    os << std::fixed << std::setprecision(1);
+    for (int w = 0; w < workers; ++w) {
+        const worker_stats& s = stats[w];
+        os << " - thread " << w
+            << " busy " << s.busy_ms << " ms"
+            << " idle " << s.idle_ms << " ms"
+            << " (" << (frame_ms > 0.0 ? 100.0 * s.busy_ms / frame_ms : 0.0) << "% busy)"
+            << " tiles " << s.tiles
+            << " stolen " << s.steals << "\n";
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+#endif
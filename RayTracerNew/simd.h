@@ -0,0 +1,92 @@
+#pragma once
+#ifndef SIMDH
+#define SIMDH
+
+// Four floats operated on together. Uses SSE where the target has it (every
+// x64 build) and plain loops otherwise; define RT_SCALAR_MATH to force the
+// loops, e.g. to check a result against the scalar code. 32-bit MSVC gets
+// the loops too: it can't pass the 16 byte aligned vec3 by value (C2719).
+//
+// vmin and vmax keep the operand order of ffmin/ffmax (a < b ? a : b), so the
+// packet tests return exactly what the single ray tests do, NaN included.
+
+#if !defined(RT_SCALAR_MATH) && (defined(__SSE2__) || defined(_M_X64))
+#define RT_SSE 1
+#include <emmintrin.h>
+#else
+#define RT_SSE 0
+#include <math.h>
+#endif
+
+#if RT_SSE
+
+struct float4 {
+    float4() {}
+    float4(__m128 v) : v(v) {}
+    explicit float4(float f) : v(_mm_set1_ps(f)) {}
+    float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+    static float4 load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    float operator[](int i) const {
+        alignas(16) float f[4];
+        _mm_store_ps(f, v);
+        return f[i];
+    }
+
+    __m128 v;
+};
+
+inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+inline float4 operator-(float4 a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline float4 sqrt(float4 a) { return _mm_sqrt_ps(a.v); }
+inline float4 vmin(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+inline float4 vmax(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+
+// comparisons give one bit per lane, lane 0 in bit 0
+inline int operator<(float4 a, float4 b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+inline int operator>(float4 a, float4 b) { return _mm_movemask_ps(_mm_cmpgt_ps(a.v, b.v)); }
+
+#else
+
+struct float4 {
+    float4() {}
+    explicit float4(float f) { e[0] = e[1] = e[2] = e[3] = f; }
+    float4(float a, float b, float c, float d) { e[0] = a; e[1] = b; e[2] = c; e[3] = d; }
+    static float4 load(const float* p) { return float4(p[0], p[1], p[2], p[3]); }
+    void store(float* p) const { p[0] = e[0]; p[1] = e[1]; p[2] = e[2]; p[3] = e[3]; }
+    float operator[](int i) const { return e[i]; }
+
+    float e[4];
+};
+
+#define RT_FLOAT4_OP(name, expr) \
+    inline float4 name(float4 a, float4 b) { \
+        float4 r; \
+        for (int i = 0; i < 4; i++) r.e[i] = (expr); \
+        return r; \
+    }
+RT_FLOAT4_OP(operator+, a.e[i] + b.e[i])
+RT_FLOAT4_OP(operator-, a.e[i] - b.e[i])
+RT_FLOAT4_OP(operator*, a.e[i] * b.e[i])
+RT_FLOAT4_OP(operator/, a.e[i] / b.e[i])
+RT_FLOAT4_OP(vmin, a.e[i] < b.e[i] ? a.e[i] : b.e[i])
+RT_FLOAT4_OP(vmax, a.e[i] > b.e[i] ? a.e[i] : b.e[i])
+#undef RT_FLOAT4_OP
+
+inline float4 operator-(float4 a) { return float4(-a.e[0], -a.e[1], -a.e[2], -a.e[3]); }
+inline float4 sqrt(float4 a) { return float4(sqrtf(a.e[0]), sqrtf(a.e[1]), sqrtf(a.e[2]), sqrtf(a.e[3])); }
+
+inline int operator<(float4 a, float4 b) {
+    int mask = 0;
+    for (int i = 0; i < 4; i++)
+        mask |= (a.e[i] < b.e[i]) << i;
+    return mask;
+}
+inline int operator>(float4 a, float4 b) { return b < a; }
+
+#endif
+
+#endif
@@ -3,13 +3,20 @@
 #define SPHEREH
 
 #include "hittable.h"
+#include "material.h"
+#include "onb.h"
 
 class sphere : public hittable {
 public:
     sphere() : center(vec3(0,0,0)), radius(10.0f), mat_ptr(nullptr) {}
-    sphere(vec3 cen, float r, material* m) : center(cen), radius(r), mat_ptr(m) {};
+    sphere(const vec3& cen, float r, material* m) : center(cen), radius(r), mat_ptr(m) {};
     virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+    virtual int hit4(const ray4& r, int active, float t_min, float* t_max, hit_record* rec) const;
     virtual bool bounding_box(float t0, float t1, aabb& box) const;
+    virtual bool is_light() const { return mat_ptr->is_emissive(); }
+    virtual float pdf_value(const vec3& o, const vec3& v) const;
+    virtual vec3 random(const vec3& o, sampler& rng) const;
+    void fill_record(const ray& r, float t, hit_record& rec) const;
     vec3 center;
     float radius;
     material* mat_ptr;
@@ -20,6 +27,14 @@ bool sphere::bounding_box(float t0, float t1, aabb& box) const {
     return true;
 }
 
+void sphere::fill_record(const ray& r, float t, hit_record& rec) const {
+    rec.t = t;
+    rec.p = r.point_at_parameter(rec.t);
+    get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
+    rec.normal = (rec.p - center) / radius;
+    rec.mat_ptr = mat_ptr;
+}
+
 bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
     vec3 oc = r.origin() - center;
     float a = dot(r.direction(), r.direction());
@@ -29,24 +44,73 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
     if (discriminant > 0) {
         float temp = (-b - sqrt(discriminant)) / a;
         if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            fill_record(r, temp, rec);
             return true;
         }
         temp = (-b + sqrt(discriminant)) / a;
         if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
+            fill_record(r, temp, rec);
             return true;
         }
     }
     return false;
 }
 
-#endif
\ No newline at end of file
+// The same arithmetic as hit() on four rays at once; only the lanes that
+// hit fill in their records.
+int sphere::hit4(const ray4& r, int active, float t_min, float* t_max, hit_record* rec) const {
+    float4 ocx = r.ox - float4(center[0]);
+    float4 ocy = r.oy - float4(center[1]);
+    float4 ocz = r.oz - float4(center[2]);
+    float4 a = r.dx * r.dx + r.dy * r.dy + r.dz * r.dz;
+    float4 b = ocx * r.dx + ocy * r.dy + ocz * r.dz;
+    float4 c = (ocx * ocx + ocy * ocy + ocz * ocz) - float4(radius * radius);
+    float4 discriminant = b * b - a * c;
+    int lanes = active & (discriminant > float4(0.0f));
+    if (!lanes)
+        return 0;
+    float4 root = sqrt(discriminant);
+    float4 near_t = (-b - root) / a;
+    float4 far_t = (-b + root) / a;
+    float4 lo(t_min);
+    float4 hi = float4::load(t_max);
+    int near_hit = (near_t < hi) & (near_t > lo);
+    int far_hit = (far_t < hi) & (far_t > lo);
+    lanes &= near_hit | far_hit;
+    for (int i = 0; i < 4; i++) {
+        if (lanes >> i & 1) {
+            fill_record(r.rays[i], (near_hit >> i & 1) ? near_t[i] : far_t[i], rec[i]);
+            t_max[i] = rec[i].t;
+        }
+    }
+    return lanes;
+}
+
+// Sampled uniformly over the cone the sphere subtends from o. From inside
+// the sphere there is no cone; the pdf is zero and the light is skipped.
+float sphere::pdf_value(const vec3& o, const vec3& v) const {
+    float distance_squared = (center - o).squared_length();
+    if (distance_squared <= radius * radius)
+        return 0;
+    hit_record rec;
+    if (!sphere::hit(ray(o, v), 0.001, FLT_MAX, rec))
+        return 0;
+    float cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    return 1 / (2 * PI * (1 - cos_theta_max));
+}
+
+vec3 sphere::random(const vec3& o, sampler& rng) const {
+    vec3 direction = center - o;
+    float distance_squared = direction.squared_length();
+    if (distance_squared <= radius * radius)
+        return direction;
+    float cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    float z = 1 + rng.next_float() * (cos_theta_max - 1);
+    float phi = 2 * PI * rng.next_float();
+    float r = sqrt(1 - z * z);
+    onb uvw;
+    uvw.build_from_w(direction);
+    return uvw.local(cos(phi) * r, sin(phi) * r, z);
+}
+
+#endif
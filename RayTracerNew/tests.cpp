@@ -0,0 +1,192 @@
+// Checks for the cases renders don't catch, run by hand or from a script:
+//
+//   g++ -std=c++14 -O2 -pthread RayTracerNew/tests.cpp -o tests && ./tests
+//
+// Prints each failure and exits non-zero if there was one.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <cstdio>
+#include <fstream>
+#include "scenes.h"
+
+int failures = 0;
+
+void Check(bool ok, const char* what, int index)
+{
+	if (!ok) {
+		std::printf("FAIL %s (case %d)\n", what, index);
+		failures++;
+	}
+}
+
+// Rays starting on a face of the unit box with a +-0 component along its
+// axis make (plane - origin) * inv_dir NaN. The packet test has to answer
+// those lanes exactly like the single ray test.
+void TestSlabNaN()
+{
+	const float bmin[3] = { 0, 0, 0 };
+	const float bmax[3] = { 1, 1, 1 };
+	std::vector<ray> rays;
+	for (int axis = 0; axis < 3; axis++)
+		for (float plane : { 0.0f, 1.0f })
+			for (float zero : { 0.0f, -0.0f })
+				for (float inside : { 0.5f, 1.5f }) {
+					vec3 o(inside, inside, inside), d(0.3f, -0.4f, 0.5f);
+					o[axis] = plane;
+					d[axis] = zero;
+					rays.push_back(ray(o, d));
+				}
+	// ordinary lanes in the same packets
+	rays.push_back(ray(vec3(-1, 0.5f, 0.5f), vec3(1, 0, 0)));
+	rays.push_back(ray(vec3(0.5f, 2, 0.5f), vec3(0, 1, 0)));
+	rays.push_back(ray(vec3(0.5f, 0.5f, 0.5f), vec3(-1, -1, -1)));
+	while (rays.size() % 4)
+		rays.push_back(rays.back());
+
+	for (size_t i = 0; i < rays.size(); i += 4) {
+		ray4 packet(&rays[i], 15);
+		int lanes = slab_hit4(bmin, bmax, packet, float4(0.0f), float4(FLT_MAX));
+		for (int k = 0; k < 4; k++) {
+			bool single = slab_hit(bmin, bmax, rays[i + k], 0.0f, FLT_MAX);
+			Check(single == bool(lanes >> k & 1), "slab_hit4 agrees with slab_hit", int(i) + k);
+		}
+	}
+}
+
+// An object BVH placed by an instance has to follow a moving sphere inside
+// it when the scene BVH is refit for a later frame, as --frames does.
+void TestInstanceRefit()
+{
+	const char* path = "tests_instance_refit.scene";
+	{
+		std::ofstream file(path);
+		file << "camera lookfrom 0 0 10 lookat 0 0 0 time 0 1\n"
+			<< "material red lambertian 0.8 0.1 0.1\n"
+			<< "object mover\n"
+			<< "moving_sphere 0 0 0 10 0 0 0 1 1 red\n"
+			<< "end\n"
+			<< "push\n"
+			<< "translate 0 5 0\n"
+			<< "instance mover\n"
+			<< "instance mover\n"
+			<< "pop\n"
+			<< "sphere 0 -100 0 1 red\n";
+	}
+	sampler rng;
+	scene world;
+	scene_view view;
+	bool loaded = load_scene(path, rng, world, view);
+	std::remove(path);
+	Check(loaded, "instance refit scene loads", 0);
+	if (!loaded)
+		return;
+
+	// frame 2: the shutter is [2, 3], and at 2.5 the sphere is centred on x = 25
+	world.bvh->refit(2.0f, 3.0f, rng);
+	hit_record rec;
+	bool hit = world.world->hit(ray(vec3(25, 5, 5), vec3(0, 0, -1), 2.5f), 0.001f, FLT_MAX, rec);
+	Check(hit && fabsf(rec.t - 4.0f) < 1e-3f, "moving sphere in an instance is hit after a refit", 0);
+	aabb box;
+	world.world->bounding_box(2.0f, 3.0f, box);
+	Check(box.max().x() >= 30.99f, "scene bounds cover the sphere over the shutter", 1);
+}
+
+// Moving an instance with set_transform and updating the scene BVH that
+// holds it is enough for rays to find it at its new place.
+void TestMoveInstance()
+{
+	const char* path = "tests_move_instance.scene";
+	{
+		std::ofstream file(path);
+		file << "camera lookfrom 0 0 10 lookat 0 0 0\n"
+			<< "material red lambertian 0.8 0.1 0.1\n"
+			<< "object ball\n"
+			<< "sphere 0 0 0 1 red\n"
+			<< "end\n"
+			<< "push\n"
+			<< "translate 0 0 1\n"
+			<< "instance ball\n"
+			<< "pop\n"
+			<< "sphere 0 -100 0 1 red\n";
+	}
+	sampler rng;
+	scene world;
+	scene_view view;
+	bool loaded = load_scene(path, rng, world, view);
+	std::remove(path);
+	Check(loaded, "move instance scene loads", 0);
+	if (!loaded)
+		return;
+
+	instance* placed = nullptr;
+	for (int i = 0; i < world.bvh->count; i++)
+		if (instance* found = dynamic_cast<instance*>(world.bvh->primitives[i]))
+			placed = found;
+	Check(placed != nullptr, "the scene BVH holds the instance", 0);
+	if (!placed)
+		return;
+	placed->set_transform(affine3::translation(vec3(20, 0, 0)));
+	world.bvh->update(rng);
+	hit_record rec;
+	Check(world.world->hit(ray(vec3(20, 0, 5), vec3(0, 0, -1)), 0.001f, FLT_MAX, rec), "moved instance is hit", 0);
+	Check(!world.world->hit(ray(vec3(0, 0, 5), vec3(0, 0, -1)), 0.001f, FLT_MAX, rec), "old place is empty", 1);
+}
+
+// Packets through the four-wide BVH, coherent ones culled by their frustum
+// and divergent ones without, have to find the same closest hits as the
+// lanes traced one at a time.
+void TestPacketsMatchRays()
+{
+	const char* path = "tests_packets.scene";
+	sampler rng(7);
+	{
+		std::ofstream file(path);
+		file << "camera lookfrom 0 0 30 lookat 0 0 0 aperture 2 focus 30\n"
+			<< "material grey lambertian 0.5 0.5 0.5\n";
+		for (int i = 0; i < 300; i++)
+			file << "sphere " << 20 * rng.next_float() - 10 << " " << 20 * rng.next_float() - 10 << " "
+				<< 20 * rng.next_float() - 10 << " " << 0.2f + 0.6f * rng.next_float() << " grey\n";
+	}
+	scene world;
+	scene_view view;
+	bool loaded = load_scene(path, rng, world, view);
+	std::remove(path);
+	Check(loaded, "packet scene loads", 0);
+	if (!loaded)
+		return;
+
+	camera cam = view.make_camera(64, 64);
+	for (int p = 0; p < 2048; p++) {
+		ray rays[4];
+		int x = p % 32 * 2, y = p / 32 % 32 * 2;
+		for (int lane = 0; lane < 4; lane++) {
+			if (p < 1024)
+				rays[lane] = cam.get_ray((x + (lane & 1) + 0.5f) / 64, (y + (lane >> 1) + 0.5f) / 64, rng);
+			else
+				rays[lane] = ray(vec3(rng.next_float(), rng.next_float(), 30), vec3(rng.next_float() - 0.5f, rng.next_float() - 0.5f, -1));
+		}
+		int active = p % 16 == 0 ? 9 : 15;
+		float tMax[4] = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
+		hit_record recs[4];
+		int hits = world.world->hit4(ray4(rays, active), active, 0.001f, tMax, recs);
+		for (int lane = 0; lane < 4; lane++) {
+			if (!(active >> lane & 1))
+				continue;
+			hit_record rec;
+			bool single = world.world->hit(rays[lane], 0.001f, FLT_MAX, rec);
+			bool same = single == bool(hits >> lane & 1) && (!single || rec.t == recs[lane].t);
+			Check(same, "packet hits match single rays", p * 4 + lane);
+		}
+	}
+}
+
+int main()
+{
+	TestSlabNaN();
+	TestInstanceRefit();
+	TestMoveInstance();
+	TestPacketsMatchRays();
+	if (failures == 0)
+		std::printf("all tests passed\n");
+	return failures == 0 ? 0 : 1;
+}
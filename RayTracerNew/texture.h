@@ -11,7 +11,7 @@ public:
 class constant_texture : public texture {
 public:
     constant_texture() { }
-    constant_texture(vec3 c) : color(c) { }
+    constant_texture(const vec3& c) : color(c) { }
     virtual vec3 value(float u, float v, const vec3& p) const {
         return color;
     }
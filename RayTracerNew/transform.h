@@ -0,0 +1,139 @@
+#pragma once
+#ifndef TRANSFORMH
+#define TRANSFORMH
+
+#include <cfloat>
+#include "aabb.h"
+
+// Affine transform stored as the top three rows of a 4x4 matrix; the last
+// row is always (0, 0, 0, 1).
+class affine3 {
+public:
+    affine3() { *this = identity(); }
+    explicit affine3(float fill) {
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 4; j++)
+                m[i][j] = fill;
+    }
+
+    static affine3 identity();
+    static affine3 translation(const vec3& offset);
+    static affine3 scaling(const vec3& factor);
+    // rotation about +y by `angle` degrees, same sense as rotate_y
+    static affine3 rotation_y(float angle);
+
+    vec3 point(const vec3& p) const {
+        return vec3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+                    m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+                    m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+    }
+    vec3 vector(const vec3& v) const {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+    // multiplies by the transpose of the linear part; called on the inverse
+    // this takes an object space normal to world space
+    vec3 transpose_vector(const vec3& v) const {
+        return vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+                    m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+                    m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+    }
+
+    affine3 inverse() const;
+    // of the linear part
+    float determinant() const {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+            - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+            + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+    aabb transform_box(const aabb& box) const;
+
+    float m[3][4];
+};
+
+affine3 affine3::identity() {
+    affine3 a(0);
+    a.m[0][0] = a.m[1][1] = a.m[2][2] = 1;
+    return a;
+}
+
+affine3 affine3::translation(const vec3& offset) {
+    affine3 a = identity();
+    a.m[0][3] = offset[0];
+    a.m[1][3] = offset[1];
+    a.m[2][3] = offset[2];
+    return a;
+}
+
+affine3 affine3::scaling(const vec3& factor) {
+    affine3 a(0);
+    a.m[0][0] = factor[0];
+    a.m[1][1] = factor[1];
+    a.m[2][2] = factor[2];
+    return a;
+}
+
+affine3 affine3::rotation_y(float angle) {
+    float radians = (PI / 180.) * angle;
+    float s = sin(radians);
+    float c = cos(radians);
+    affine3 a = identity();
+    a.m[0][0] = c;  a.m[0][2] = s;
+    a.m[2][0] = -s; a.m[2][2] = c;
+    return a;
+}
+
+// a * b applies b first
+inline affine3 operator*(const affine3& a, const affine3& b) {
+    affine3 r(0);
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+        }
+        r.m[i][3] += a.m[i][3];
+    }
+    return r;
+}
+
+affine3 affine3::inverse() const {
+    // inverse of the 3x3 part by cofactors, then undo the translation
+    float a00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    float a01 = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+    float a02 = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+    float a10 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    float a11 = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+    float a12 = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+    float a20 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    float a21 = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+    float a22 = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+    float inv_det = 1.0f / (m[0][0] * a00 + m[0][1] * a10 + m[0][2] * a20);
+
+    affine3 r(0);
+    r.m[0][0] = a00 * inv_det; r.m[0][1] = a01 * inv_det; r.m[0][2] = a02 * inv_det;
+    r.m[1][0] = a10 * inv_det; r.m[1][1] = a11 * inv_det; r.m[1][2] = a12 * inv_det;
+    r.m[2][0] = a20 * inv_det; r.m[2][1] = a21 * inv_det; r.m[2][2] = a22 * inv_det;
+    vec3 t = r.vector(vec3(m[0][3], m[1][3], m[2][3]));
+    r.m[0][3] = -t[0];
+    r.m[1][3] = -t[1];
+    r.m[2][3] = -t[2];
+    return r;
+}
+
+aabb affine3::transform_box(const aabb& box) const {
+    vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX);
+    vec3 hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int i = 0; i < 8; i++) {
+        vec3 corner((i & 1) ? box.max().x() : box.min().x(),
+                    (i & 2) ? box.max().y() : box.min().y(),
+                    (i & 4) ? box.max().z() : box.min().z());
+        vec3 p = point(corner);
+        for (int c = 0; c < 3; c++) {
+            lo[c] = ffmin(lo[c], p[c]);
+            hi[c] = ffmax(hi[c], p[c]);
+        }
+    }
+    return aabb(lo, hi);
+}
+
+#endif
@@ -3,13 +3,27 @@
 #include <math.h>
 #include <stdlib.h>
 #include <iostream>
+#include "simd.h"
 
 const float PI = 3.14159265358979f;
 
+// With SSE (see simd.h) a vec3 is one 16 byte register whose fourth lane is
+// kept at zero where that is free and never read. The operators do the
+// same arithmetic in the same order as the scalar ones, dot products
+// included, so both builds render the same image; define RT_SCALAR_MATH for
+// the plain float[3] version.
+#if RT_SSE
+class alignas(16) vec3 {
+public:
+    vec3() {}
+    vec3(__m128 v) : m(v) {}
+    vec3(float e0, float e1, float e2) : m(_mm_setr_ps(e0, e1, e2, 0.0f)) {}
+#else
 class vec3 {
 public:
     vec3() {}
     vec3(float e0, float e1, float e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
+#endif
     inline float x() const { return e[0]; }
     inline float y() const { return e[1]; }
     inline float z() const { return e[2]; }
@@ -18,7 +32,11 @@ public:
     inline float b() const { return e[2]; }
 
     inline const vec3& operator+() const { return *this; }
+#if RT_SSE
+    inline vec3 operator-() const { return _mm_xor_ps(m, _mm_set1_ps(-0.0f)); }
+#else
     inline vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
+#endif
     inline float operator[](int i) const { return e[i]; }
     inline float& operator[](int i) { return e[i]; }
 
@@ -33,13 +51,32 @@ public:
 //	vec3 cross(const vec3& v1, const vec3& v2);
 
 	//inline vec3 cross(const vec3& v1, const vec3& v2);
-    inline float length() const { return sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]); }
-    inline float squared_length() const { return e[0] * e[0] + e[1] * e[1] + e[2] * e[2]; }
+    inline float length() const { return sqrt(squared_length()); }
+    inline float squared_length() const;
     inline void make_unit_vector();
 
+#if RT_SSE
+    union {
+        __m128 m;
+        float e[4];
+    };
+#else
     float e[3];
+#endif
 };
 
+#if RT_SSE
+// x * x + y * y + z * z, added left to right like the scalar code
+inline float sum3(__m128 p) {
+    __m128 s = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2))));
+}
+
+inline float vec3::squared_length() const { return sum3(_mm_mul_ps(m, m)); }
+#else
+inline float vec3::squared_length() const { return e[0] * e[0] + e[1] * e[1] + e[2] * e[2]; }
+#endif
+
 inline std::istream& operator>>(std::istream& is, vec3& t) {
     is >> t.e[0] >> t.e[1] >> t.e[2];
     return is;
@@ -52,9 +89,44 @@ inline std::ostream& operator<<(std::ostream& os, const vec3& t) {
 
 inline void vec3::make_unit_vector() {
     float k = 1.0 / sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
-    e[0] *= k; e[1] *= k; e[2] *= k;
+    *this *= k;
+}
+
+#if RT_SSE
+
+inline vec3 operator+(const vec3& v1, const vec3& v2) { return _mm_add_ps(v1.m, v2.m); }
+inline vec3 operator-(const vec3& v1, const vec3& v2) { return _mm_sub_ps(v1.m, v2.m); }
+inline vec3 operator*(const vec3& v1, const vec3& v2) { return _mm_mul_ps(v1.m, v2.m); }
+// the three divisions are one instruction, and stay exact
+inline vec3 operator/(const vec3& v1, const vec3& v2) { return _mm_div_ps(v1.m, v2.m); }
+inline vec3 operator*(float t, const vec3& v) { return _mm_mul_ps(_mm_set1_ps(t), v.m); }
+inline vec3 operator/(const vec3& v, float t) { return _mm_div_ps(v.m, _mm_set1_ps(t)); }
+inline vec3 operator*(const vec3& v, float t) { return _mm_mul_ps(_mm_set1_ps(t), v.m); }
+
+inline float dot(const vec3& v1, const vec3& v2) { return sum3(_mm_mul_ps(v1.m, v2.m)); }
+
+inline vec3 cross(const vec3& v1, const vec3& v2) {
+    __m128 a_yzx = _mm_shuffle_ps(v1.m, v1.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(v2.m, v2.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 a_zxy = _mm_shuffle_ps(v1.m, v1.m, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 b_zxy = _mm_shuffle_ps(v2.m, v2.m, _MM_SHUFFLE(3, 1, 0, 2));
+    return _mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx));
+}
+
+inline vec3& vec3::operator+=(const vec3& v) { m = _mm_add_ps(m, v.m); return *this; }
+inline vec3& vec3::operator*=(const vec3& v) { m = _mm_mul_ps(m, v.m); return *this; }
+inline vec3& vec3::operator/=(const vec3& v) { m = _mm_div_ps(m, v.m); return *this; }
+inline vec3& vec3::operator-=(const vec3& v) { m = _mm_sub_ps(m, v.m); return *this; }
+inline vec3& vec3::operator*=(const float t) { m = _mm_mul_ps(m, _mm_set1_ps(t)); return *this; }
+
+inline vec3& vec3::operator/=(const float t) {
+    float k = 1.0 / t;
+    m = _mm_mul_ps(m, _mm_set1_ps(k));
+    return *this;
 }
 
+#else
+
 inline vec3 operator+(const vec3& v1, const vec3& v2) {
     return vec3(v1.e[0] + v2.e[0], v1.e[1] + v2.e[1], v1.e[2] + v2.e[2]);
 }
@@ -75,7 +147,7 @@ inline vec3 operator*(float t, const vec3& v) {
     return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator/(vec3 v, float t) {
+inline vec3 operator/(const vec3& v, float t) {
     return vec3(v.e[0] / t, v.e[1] / t, v.e[2] / t);
 }
 
@@ -137,6 +209,8 @@ inline vec3& vec3::operator/=(const float t) {
     return *this;
 }
 
+#endif
+
 //inline vec3 vec3::cross(const vec3& v1, const vec3& v2)
 //{
 //	return vec3(v1.e[1] * v2.e[2] - v1.e[2] * v2.e[1],
@@ -144,6 +218,6 @@ inline vec3& vec3::operator/=(const float t) {
 //		v1.e[0] * v2.e[1] - v1.e[1] * v2.e[0]);
 //}
 
-inline vec3 unit_vector(vec3 v) {
+inline vec3 unit_vector(const vec3& v) {
     return v / v.length();
-}
\ No newline at end of file
+}